@@ -1,10 +1,21 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each hash bucket has its own lock, so that lookups of
+// different blocks on different harts do not contend.
+//
+// Besides the NBUF static buffers, the cache grows on a
+// miss, a page of buffers at a time, up to NBUFMAX buffers.
+// When kalloc() runs out of memory it calls bcacheshrink()
+// to give back pages whose buffers are all unused. Once the
+// cache can't grow, a miss recycles the least recently used
+// unused buffer, which may have to be taken from another
+// bucket, or waits for one if every buffer is in use.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -23,33 +34,322 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 61
+#define BPERPAGE 3       // buffers in a page-sized chunk
+#define SHRINKBATCH 16   // most pages bcacheshrink() frees at once
+#define BSPARE (-2)      // b->bucket of buffers on the spare list
+#define RABATCH 16       // most blocks breadahead() submits together
+
+// a page of buffers, allocated with kalloc().
+struct bchunk {
+  struct bchunk *next;
+  struct buf buf[BPERPAGE];
+};
+
+struct bucket {
   struct spinlock lock;
+  struct buf head;   // list of buffers, through prev/next
+
+  // statistics, protected by lock.
+  uint64 nhit;       // lookups that found the block
+  uint64 nmiss;      // lookups that had to recycle a buffer
+  uint64 nsteal;     // misses that took a buffer from another bucket
+  uint64 nreadahead; // blocks read by breadahead()
+};
+
+struct {
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+
+  struct spinlock chunklock;
+  struct bchunk *chunks;  // list of pages of buffers
+  struct buf *spares;     // unused buffers in no bucket, through next
+  int nbuf;               // static buffers plus those in chunks
+  uint64 ngrow;           // pages added
+  uint64 nshrink;         // pages given back to kalloc()
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // bpick() sleeps on nwaiter when all buffers are in use.
+  struct spinlock waitlock;
+  int nwaiter;
 } bcache;
 
+static int
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
+// Add b to the front of bucket k's list.
+// Caller must hold k's lock.
+static void
+binsert(int k, struct buf *b)
+{
+  struct buf *head = &bcache.bucket[k].head;
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  b->bucket = k;
+}
+
+// Remove b from its bucket's list.
+// Caller must hold the bucket's lock.
+static void
+bremove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->bucket = -1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  if(sizeof(struct bchunk) > PGSIZE)
+    panic("binit: bchunk");
+
+  for(int k = 0; k < NBUCKET; k++){
+    initlock(&bcache.bucket[k].lock, "bcache");
+    bcache.bucket[k].head.prev = &bcache.bucket[k].head;
+    bcache.bucket[k].head.next = &bcache.bucket[k].head;
+  }
+  initlock(&bcache.chunklock, "bcache.chunk");
+  initlock(&bcache.waitlock, "bcache.wait");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // spread the buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binsert((b - bcache.buf) % NBUCKET, b);
   }
+  bcache.nbuf = NBUF;
+}
+
+// Put unused buffer b, which is in no bucket, on the
+// list of spares. Caller must hold chunklock.
+static void
+bputspare(struct buf *b)
+{
+  b->bucket = BSPARE;
+  b->refcnt = 0;
+  b->next = bcache.spares;
+  bcache.spares = b;
+}
+
+// Return an unused buffer that is in no bucket, with
+// refcnt 1: a spare if there is one, or else a buffer
+// from a new page of buffers, if the cache may grow and
+// there is free memory. Returns 0 if neither.
+// Must not be called with a bucket lock held, since
+// kalloc() may call bcacheshrink().
+static struct buf*
+bnew(void)
+{
+  struct bchunk *c;
+  struct buf *b;
+
+  acquire(&bcache.chunklock);
+  if((b = bcache.spares) != 0)
+    bcache.spares = b->next;
+  if(b || bcache.nbuf + BPERPAGE > NBUFMAX)
+    goto out;
+  release(&bcache.chunklock);
+
+  if((c = (struct bchunk*)kalloc()) == 0)
+    return 0;
+  for(int i = 0; i < BPERPAGE; i++)
+    initsleeplock(&c->buf[i].lock, "buffer");
+
+  acquire(&bcache.chunklock);
+  if(bcache.nbuf + BPERPAGE > NBUFMAX){
+    // others grew the cache meanwhile.
+    release(&bcache.chunklock);
+    kfree(c);
+    return 0;
+  }
+  c->next = bcache.chunks;
+  bcache.chunks = c;
+  bcache.nbuf += BPERPAGE;
+  bcache.ngrow++;
+  for(int i = 1; i < BPERPAGE; i++)
+    bputspare(&c->buf[i]);
+  b = &c->buf[0];
+
+ out:
+  if(b){
+    b->bucket = -1;
+    b->refcnt = 1;
+  }
+  release(&bcache.chunklock);
+  return b;
+}
+
+// Take unused buffer b off its bucket's list, marking it
+// in transit with refcnt 1, as bvictim() does.
+// Returns 0 if b is in use or in transit.
+static int
+bclaim(struct buf *b)
+{
+  int k;
+
+  for(;;){
+    k = b->bucket;
+    if(k < 0)
+      return 0;
+    acquire(&bcache.bucket[k].lock);
+    if(b->bucket == k)
+      break;
+    // moved to another bucket meanwhile.
+    release(&bcache.bucket[k].lock);
+  }
+  if(b->refcnt != 0){
+    release(&bcache.bucket[k].lock);
+    return 0;
+  }
+  bremove(b);
+  b->refcnt = 1;
+  release(&bcache.bucket[k].lock);
+  return 1;
+}
+
+// Give pages of buffers that no one is using back to
+// kalloc(), at most SHRINKBATCH of them.
+// Called by kalloc() when it runs out of memory.
+// Returns the number of pages freed.
+int
+bcacheshrink(void)
+{
+  struct bchunk *c, **cp;
+  struct buf **bp;
+  int i, j, n = 0;
+
+  acquire(&bcache.chunklock);
+  for(cp = &bcache.chunks; *cp && n < SHRINKBATCH; ){
+    c = *cp;
+    for(i = 0; i < BPERPAGE; i++){
+      if(c->buf[i].bucket != BSPARE && !bclaim(&c->buf[i]))
+        break;
+    }
+    if(i < BPERPAGE){
+      // some buffer is in use. the ones claimed go
+      // back as spares, not to their buckets, since
+      // their blocks may have been cached again.
+      for(j = 0; j < i; j++){
+        if(c->buf[j].bucket != BSPARE)
+          bputspare(&c->buf[j]);
+      }
+      cp = &c->next;
+      continue;
+    }
+    for(bp = &bcache.spares; *bp; ){
+      if(*bp >= c->buf && *bp < c->buf + BPERPAGE)
+        *bp = (*bp)->next;
+      else
+        bp = &(*bp)->next;
+    }
+    *cp = c->next;
+    bcache.nbuf -= BPERPAGE;
+    bcache.nshrink++;
+    kfree(c);
+    n++;
+  }
+  release(&bcache.chunklock);
+  return n;
+}
+
+// Find the least recently used buffer that no one is
+// using, remove it from its bucket, and return it with
+// refcnt 1, setting *from to the bucket it was in.
+// Holds only one bucket lock at a time, so the choice
+// is re-checked under the chosen bucket's lock.
+// Returns 0 if every buffer is in use.
+static struct buf*
+bvictim(int *from)
+{
+  struct buf *b, *best;
+  uint lastuse;
+  int k, bk;
+
+  for(;;){
+    best = 0;
+    bk = -1;
+    lastuse = 0;
+    for(k = 0; k < NBUCKET; k++){
+      struct bucket *bkt = &bcache.bucket[k];
+      acquire(&bkt->lock);
+      for(b = bkt->head.next; b != &bkt->head; b = b->next){
+        if(b->refcnt == 0 && (best == 0 || b->lastuse < lastuse)){
+          best = b;
+          bk = k;
+          lastuse = b->lastuse;
+        }
+      }
+      release(&bkt->lock);
+    }
+    if(best == 0)
+      return 0;
+
+    acquire(&bcache.bucket[bk].lock);
+    if(best->bucket == bk && best->refcnt == 0 && best->lastuse == lastuse){
+      bremove(best);
+      best->refcnt = 1;
+      release(&bcache.bucket[bk].lock);
+      *from = bk;
+      return best;
+    }
+    // someone else took it; look again.
+    release(&bcache.bucket[bk].lock);
+  }
+}
+
+// Return a buffer, in no bucket and with refcnt 1, for a
+// block that is not cached: a spare or new buffer if
+// there is one, else the LRU unused buffer. Sets *from
+// to the bucket the buffer was taken from, or -1.
+// Waits if every buffer is in use.
+static struct buf*
+bpick(int *from)
+{
+  struct buf *b;
+
+  *from = -1;
+  if((b = bnew()) != 0 || (b = bvictim(from)) != 0)
+    return b;
+
+  acquire(&bcache.waitlock);
+  bcache.nwaiter++;
+  // look again after nwaiter++, so that a brelse()
+  // in between can't miss us.
+  while((b = bnew()) == 0 && (b = bvictim(from)) == 0)
+    sleep(&bcache.nwaiter, &bcache.waitlock);
+  bcache.nwaiter--;
+  release(&bcache.waitlock);
+  return b;
+}
+
+// Make unused buffer b, which is in no bucket, a spare.
+static void
+bunuse(struct buf *b)
+{
+  acquire(&bcache.chunklock);
+  bputspare(b);
+  release(&bcache.chunklock);
+}
+
+// Return the buffer caching block blockno on device dev,
+// or 0. Caller must hold the lock of the block's bucket.
+static struct buf*
+blookup(struct bucket *bkt, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bkt->head.next; b != &bkt->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,34 +358,50 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  int h = bhash(dev, blockno), from;
+  struct bucket *bkt = &bcache.bucket[h];
 
-  acquire(&bcache.lock);
+  acquire(&bkt->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = blookup(bkt, dev, blockno)) != 0){
+    b->refcnt++;
+    bkt->nhit++;
+    release(&bkt->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bkt->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Use a spare or new buffer if the cache can grow,
+  // else recycle the least recently used (LRU) unused buffer.
+  victim = bpick(&from);
+
+  acquire(&bkt->lock);
+
+  // Another process may have cached the block
+  // while no lock was held.
+  if((b = blookup(bkt, dev, blockno)) != 0){
+    b->refcnt++;
+    bkt->nhit++;
+    release(&bkt->lock);
+    bunuse(victim);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+
+  bkt->nmiss++;
+  if(from >= 0 && from != h)
+    bkt->nsteal++;
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  binsert(h, victim);
+  release(&bkt->lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -111,43 +427,209 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing bufs[0..n-1] to disk, and return without
+// waiting. Each must be locked, and stays locked; the caller
+// must bwait() each before it can brelse() it or use it again.
+// Lets a caller keep several writes in flight at once, and
+// buffers for consecutive blocks go to the disk together.
+void
+bsubmit(struct buf **bufs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bsubmit");
+  virtio_disk_submitv(bufs, n, 1, 0);
+}
+
+// Wait for a write started by bsubmit() to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
+static void bput(struct buf *b);
+
+// Called by virtio_disk_intr() when a read started by
+// breadahead() completes.
+static void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  bput(b);
+}
+
+// Return a locked buffer for block blockno on device dev,
+// for breadahead() to read into, or 0 if the block is cached
+// already or every buffer is in use.
+static struct buf*
+braclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+  int h = bhash(dev, blockno), from = -1;
+  struct bucket *bkt = &bcache.bucket[h];
+
+  acquire(&bkt->lock);
+  b = blookup(bkt, dev, blockno);
+  release(&bkt->lock);
+  if(b)
+    return 0;
+
+  if((b = bnew()) == 0 && (b = bvictim(&from)) == 0)
+    return 0;
+  // b is in no bucket, so no one else holds its lock.
+  acquiresleep(&b->lock);
+
+  acquire(&bkt->lock);
+  if(blookup(bkt, dev, blockno)){
+    release(&bkt->lock);
+    releasesleep(&b->lock);
+    bunuse(b);
+    return 0;
+  }
+  bkt->nreadahead++;
+  if(from >= 0 && from != h)
+    bkt->nsteal++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  binsert(h, b);
+  release(&bkt->lock);
+  return b;
+}
+
+// Start reading blocks blockno[0..n-1] on device dev into
+// the cache, skipping those there already, and return
+// without waiting. Blocks that are consecutive on the disk
+// are read with one request. A later bread() of a block
+// waits for its read to finish.
+void
+breadahead(uint dev, uint *blockno, int n)
+{
+  struct buf *b, *bufs[RABATCH];
+  int nb = 0;
+
+  for(int i = 0; i < n; i++){
+    if((b = braclaim(dev, blockno[i])) != 0)
+      bufs[nb++] = b;
+    if(nb == RABATCH || (i == n-1 && nb > 0)){
+      // each b stays locked until its read completes;
+      // then breaddone() releases it. this process goes
+      // on running meanwhile, so it must not look like
+      // an owner worth spinning for.
+      for(int j = 0; j < nb; j++)
+        disownsleep(&bufs[j]->lock);
+      virtio_disk_submitv(bufs, nb, 0, breaddone);
+      nb = 0;
+    }
+  }
+}
+
+// Return a locked buffer that is in no bucket, so that no
+// lookup can find it. The caller fills in dev, blockno and
+// data and writes it with bwrite() or bsubmit(); the log
+// uses this to write a snapshot of a block while the cached
+// copy moves on. Give it back with bprivfree().
+// Waits if every buffer is in use.
+struct buf*
+bprivate(void)
+{
+  struct buf *b;
+  int from;
+
+  b = bpick(&from);
+  // b is in no bucket, so no one else holds its lock.
+  acquiresleep(&b->lock);
+  b->valid = 0;
+  return b;
+}
+
+// Give back a buffer returned by bprivate().
+void
+bprivfree(struct buf *b)
+{
+  if(!holdingsleep(&b->lock) || b->bucket != -1)
+    panic("bprivfree");
+  releasesleep(&b->lock);
+  bunuse(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b);
+}
+
+// Unlock b and drop a reference to it.
+// Once no one is using it, note when it was last used,
+// for the LRU choice in bvictim().
+static void
+bput(struct buf *b)
+{
+  struct bucket *bkt;
+  int idle;
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b can't change buckets while refcnt > 0.
+  bkt = &bcache.bucket[b->bucket];
+  acquire(&bkt->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
+  idle = b->refcnt == 0;
+  if (idle) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
+  }
+  release(&bkt->lock);
+
+  if(idle && bcache.nwaiter > 0){
+    acquire(&bcache.waitlock);
+    wakeup(&bcache.nwaiter);
+    release(&bcache.waitlock);
   }
-  
-  release(&bcache.lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[b->bucket];
+
+  acquire(&bkt->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[b->bucket];
+
+  acquire(&bkt->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
+// Report buffer cache statistics for the statistics device.
+int
+bcachestats(char *buf, int sz)
+{
+  uint64 nhit = 0, nmiss = 0, nsteal = 0, nra = 0, nacq = 0, nspin = 0;
+  int n = 0;
 
+  for(int k = 0; k < NBUCKET; k++){
+    struct bucket *bkt = &bcache.bucket[k];
+    nhit += bkt->nhit;
+    nmiss += bkt->nmiss;
+    nsteal += bkt->nsteal;
+    nra += bkt->nreadahead;
+    nacq += bkt->lock.n;
+    nspin += bkt->lock.nts;
+  }
+  n += snprintf(buf+n, sz-n, "--- bcache\n");
+  n += snprintf(buf+n, sz-n, "hit %ld miss %ld steal %ld lock #acquire %ld #spin %ld\n",
+                nhit, nmiss, nsteal, nacq, nspin);
+  n += snprintf(buf+n, sz-n, "buffers %d grow %ld shrink %ld readahead %ld\n",
+                bcache.nbuf, bcache.ngrow, bcache.nshrink, nra);
+  return n;
+}
@@ -5,8 +5,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int bucket;       // hash bucket b is in; -1 in transit, -2 spare
+  uint lastuse;     // ticks when refcnt last dropped to 0
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  // virtio_disk_intr()'s list of completed requests
+  // to call done functions for.
+  struct buf *donenext;
+  void (*done)(struct buf*);
   uchar data[BSIZE];
 };
 
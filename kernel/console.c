@@ -77,13 +77,17 @@ consolewrite(int user_src, uint64 src, int n)
 // or kernel address.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, uint off)
 {
   uint target;
   int c;
   char cbuf;
 
   target = n;
+  // either_copyout() below must not sleep, so it would fail
+  // too, after taking input from the buffer.
+  if(user_dst && execprefault(dst, n) < 0)
+    return -1;
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -1,9 +1,11 @@
 struct buf;
 struct context;
+struct uclock;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rwlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -14,8 +16,15 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bsubmit(struct buf**, int);
+void            bwait(struct buf*);
+void            breadahead(uint, uint*, int);
+struct buf*     bprivate(void);
+void            bprivfree(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcachestats(char*, int);
+int             bcacheshrink(void);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +33,13 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+void            textinit(void);
+int             execfault(struct proc*, uint64);
+int             execprefault(uint64, uint64);
+void            execinval(struct inode*);
+struct inode*   execdup(struct inode*);
+void            execput(struct inode*);
+int             execstats(char*, int);
 
 // file.c
 struct file*    filealloc(void);
@@ -42,6 +58,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -63,18 +80,28 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kmemstats(char*, int);
+void            krefinc(void*);
+int             krefcnt(void*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxblocks(void);
+void            log_force(void);
+int             logstats(char*, int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesplice(struct pipe*, uint64, int);
+int             pipestats(char*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -90,12 +117,19 @@ void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             kthread(char*, void (*)(void));
+void            preempt(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            schedboost(void);
+int             schedstats(char*, int);
+int             cpustats(char*, int);
+int             setpriority(int, int);
+void            setrunnable(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
@@ -112,15 +146,28 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             lockstats(char*, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// rwlock.c
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+void            initrwlock(struct rwlock*, char*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            disownsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+int             sleeplockstats(char*, int);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -131,6 +178,12 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -139,12 +192,27 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+void            ringpoll(struct proc*);
+int             ringstats(char*, int);
+
+// timer.c
+int             timersleep(int);
+void            timertick(void);
+int             timerstats(char*, int);
+
+// start.c
+int             clockpending(void);
+
 // trap.c
 extern uint     ticks;
+extern struct uclock *uclock;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+void            usertrap(void);
 void            usertrapret(void);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -154,18 +222,28 @@ void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
+extern int      nasid;
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmreset(pagetable_t);
+void            kvmfree(pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64, int);
+int             vmstats(char*, int);
+void            vmsetfastcopy(int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+uint64          uvmshare(pagetable_t, uint64);
+int             uvmreplace(pagetable_t, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -180,7 +258,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int, void (*)(struct buf *));
+void            virtio_disk_submitv(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
+int             virtiostats(char*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -3,21 +3,282 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// exec() does not read the program in. Its pages are read
+// from the program file when first touched, by execfault().
+// Full pages of file contents are also kept in a small
+// cache, so that processes running the same program share
+// them: read-only, or copy-on-write if the segment is
+// writable.
+//
+// Since a running process may still have pages to read in,
+// the file can't be opened for writing, written or truncated
+// while any process runs it (ip->nexec > 0). Once none does,
+// writing or truncating it drops its pages from the cache.
+
+#define NTEXT 256  // pages in the cache
+
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;
+    uint off;      // offset of the page in the file
+    uint64 pa;     // 0 if the slot is free
+  } page[NTEXT];
+  int hand;        // next slot to consider for eviction
+
+  // statistics, protected by lock.
+  uint64 nfault;   // pages read in from program files
+  uint64 nshared;  // faults satisfied from the cache
+} text;
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+}
+
+// Look for page off of ip in the cache.
+// If found, returns its physical address with a
+// reference added for the caller.
+static uint64
+textlookup(struct inode *ip, uint off)
+{
+  uint64 pa = 0;
+
+  acquire(&text.lock);
+  for(int i = 0; i < NTEXT; i++){
+    if(text.page[i].pa && text.page[i].dev == ip->dev &&
+       text.page[i].inum == ip->inum && text.page[i].off == off){
+      pa = text.page[i].pa;
+      krefinc((void*)pa);
+      text.nshared++;
+      break;
+    }
+  }
+  release(&text.lock);
+  return pa;
+}
+
+// Add page pa, holding page off of ip, to the cache.
+// Only evicts pages that no process maps.
+// Caller must hold ip->lock, so that the contents
+// can't change before the page is in the cache.
+// Since it may hold it shared, two processes that
+// miss at once can both insert the page; that only
+// wastes a slot.
+static void
+textinsert(struct inode *ip, uint off, uint64 pa)
+{
+  acquire(&text.lock);
+  for(int n = 0; n < NTEXT; n++){
+    int i = text.hand;
+    text.hand = (text.hand + 1) % NTEXT;
+    if(text.page[i].pa && krefcnt((void*)text.page[i].pa) > 1)
+      continue;
+    if(text.page[i].pa)
+      kfree((void*)text.page[i].pa);
+    text.page[i].dev = ip->dev;
+    text.page[i].inum = ip->inum;
+    text.page[i].off = off;
+    text.page[i].pa = pa;
+    krefinc((void*)pa);
+    ip->textcached = 1;
+    break;
+  }
+  release(&text.lock);
+}
+
+// Drop ip's pages from the cache, because its
+// contents are about to change.
+// Caller must hold ip->lock.
+void
+execinval(struct inode *ip)
+{
+  if(ip->textcached == 0)
+    return;
+  acquire(&text.lock);
+  for(int i = 0; i < NTEXT; i++){
+    if(text.page[i].pa && text.page[i].dev == ip->dev &&
+       text.page[i].inum == ip->inum){
+      kfree((void*)text.page[i].pa);
+      text.page[i].pa = 0;
+    }
+  }
+  ip->textcached = 0;
+  release(&text.lock);
+}
+
+// Note that one more process runs the program in ip,
+// returning another reference to ip. nexec only goes from
+// 0 to 1 in exec(), with ip locked, so writers holding ip's
+// lock can rely on it.
+struct inode*
+execdup(struct inode *ip)
+{
+  __sync_fetch_and_add(&ip->nexec, 1);
+  return idup(ip);
+}
+
+// Drop a process's reference to the program in ip.
+// Must be called inside a transaction, like iput().
+void
+execput(struct inode *ip)
+{
+  __sync_fetch_and_sub(&ip->nexec, 1);
+  iput(ip);
+}
+
+// Map the page of p's program image that contains va,
+// reading it from p->execip or the cache.
+// Returns 0 on success, -1 on failure.
+int
+execfault(struct proc *p, uint64 va)
+{
+  struct inode *ip = p->execip;
+  struct execseg *seg = 0;
+  uint64 a = PGROUNDDOWN(va), pa;
+  uint off = 0, n = 0;
+  int perm = PTE_W|PTE_X|PTE_R|PTE_U;
+  int locked = 0, held;
+  char *mem;
+
+  for(int i = 0; i < p->nexecseg; i++){
+    if(a >= p->execseg[i].va && a < p->execseg[i].va + p->execseg[i].memsz){
+      seg = &p->execseg[i];
+      break;
+    }
+  }
+  if(seg){
+    perm = seg->perm;
+    if(a - seg->va < seg->filesz){
+      off = seg->off + (a - seg->va);
+      n = seg->filesz - (a - seg->va);
+      if(n > PGSIZE)
+        n = PGSIZE;
+    }
+  }
+
+  if(n == 0){
+    // bss, or a gap between segments.
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, a, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  // reading the file may sleep, which is not allowed
+  // while holding a spinlock; callers that copy to user
+  // memory with one held run execprefault() first.
+  push_off();
+  held = mycpu()->noff > 1;
+  pop_off();
+  if(held)
+    return -1;
+
+  // a fault inside writei() on ip itself. holdingsleep()
+  // can't see that this process holds ip shared, and
+  // ilockshared() would then wait behind a queued writer,
+  // so fileread() faults in its buffer with execprefault()
+  // before it takes the lock, and fails if it can't.
+  if(!holdingsleep(&ip->lock)){
+    ilockshared(ip);
+    locked = 1;
+  }
+
+  pa = 0;
+  if(n == PGSIZE)
+    pa = textlookup(ip, off);
+  if(pa == 0){
+    if((mem = kalloc()) == 0)
+      goto bad;
+    if(n < PGSIZE)
+      memset(mem, 0, PGSIZE);
+    if(readi(ip, 0, (uint64)mem, off, n) != n){
+      kfree(mem);
+      goto bad;
+    }
+    pa = (uint64)mem;
+    if(n == PGSIZE)
+      textinsert(ip, off, pa);
+  }
+  if(locked)
+    iunlock(ip);
+
+  if(krefcnt((void*)pa) > 1 && (perm & PTE_W))
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(p->pagetable, a, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+
+  acquire(&text.lock);
+  text.nfault++;
+  release(&text.lock);
+  return 0;
+
+ bad:
+  if(locked)
+    iunlock(ip);
+  return -1;
+}
+
+// Read in the pages of [va, va+n) that belong to the
+// current process's program image and are not mapped
+// yet. Copies to user memory made while holding a
+// spinlock or an inode lock call this first, because
+// execfault() sleeps and takes p->execip's lock.
+// Returns -1 if a page could not be read in.
+int
+execprefault(uint64 va, uint64 n)
+{
+  struct proc *p = myproc();
+
+  for(uint64 a = PGROUNDDOWN(va); a < va + n && a < p->execsz; a += PGSIZE){
+    if(walkaddr(p->pagetable, a) == 0 && execfault(p, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Report demand paging counts for the statistics device.
+int
+execstats(char *buf, int sz)
+{
+  int n = 0, ncached = 0;
+
+  acquire(&text.lock);
+  for(int i = 0; i < NTEXT; i++)
+    if(text.page[i].pa)
+      ncached++;
+  n += snprintf(buf+n, sz-n, "--- exec\n");
+  n += snprintf(buf+n, sz-n, "page faults %ld shared %ld cached pages %d\n",
+                text.nfault, text.nshared, ncached);
+  release(&text.lock);
+  return n;
+}
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  int i, off, nseg;
+  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase, execsz;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *eip = 0, *oldip;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -27,7 +288,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,7 +299,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe the program's segments; execfault()
+  // reads them in later.
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,15 +311,26 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    sz = sz1;
     if((ph.vaddr % PGSIZE) != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz > MAXUVA)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+      goto bad;
+    if(nseg >= NEXECSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = PTE_R|PTE_X|PTE_U;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      seg[nseg].perm |= PTE_W;
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
+  // writers are locked out from here on.
+  eip = execdup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -67,6 +341,9 @@ exec(char *path, char **argv)
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
+  execsz = sz;
+  if(sz + 2*PGSIZE > MAXUVA)
+    goto bad;
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
@@ -110,11 +387,28 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldip = p->execip;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->execip = eip;
+  p->execsz = execsz;
+  p->nexecseg = nseg;
+  memmove(p->execseg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  p->ring = 0;
+  // the new page table has the old one's ASIDs, so flush
+  // the old one's translations, and the kernel page table's
+  // of its PTEs.
+  kvmreset(p->kpagetable);
+  sfence_vma_asid(p->asid);
+  sfence_vma_asid(p->asid + 1);
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldip){
+    begin_op();
+    execput(oldip);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,30 +419,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
-  return -1;
-}
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  if(eip){
+    begin_op();
+    execput(eip);
+    end_op();
   }
-  
-  return 0;
+  return -1;
 }
@@ -91,7 +91,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -116,9 +116,22 @@ fileread(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    if((r = devsw[f->major].read(1, addr, n, f->off)) > 0)
+      f->off += r;
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // page in program text first; faulting it in
+    // while holding f->ip's lock shared could deadlock
+    // (see execfault()), so give up if that fails.
+    if(execprefault(addr, n) < 0)
+      return -1;
+    // readers of the inode can share its lock, but f->off
+    // needs it exclusive if other processes share f too.
+    // (without threads, only this process can make f->ref
+    // go from 1 to 2, and it is busy here.)
+    if(f->ref == 1)
+      ilockshared(f->ip);
+    else
+      ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -146,25 +159,34 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks at a time as fit in half the log,
+    // leaving room for other system calls, and reserve log
+    // space for the i-node, indirect block, allocation
+    // blocks, and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
+    int max = ((log_maxblocks()/2-1-1-2) / 2) * BSIZE;
+    int i = 0, nres;
+    if(max < BSIZE)
+      max = BSIZE;
+    // as in fileread(): a fault in writei() would take
+    // p->execip's lock while holding f->ip's.
+    if(execprefault(addr, n) < 0)
+      return -1;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      nres = 2*((n1 + BSIZE-1) / BSIZE) + 1 + 1 + 2;
+      if(nres < MAXOPBLOCKS)
+        nres = MAXOPBLOCKS;
 
-      begin_op();
+      begin_opn(nres);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nres);
 
       if(r != n1){
         // error from writei
@@ -5,7 +5,7 @@ struct file {
   char writable;
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
-  uint off;          // FD_INODE
+  uint off;          // FD_INODE and FD_DEVICE
   short major;       // FD_DEVICE
 };
 
@@ -20,6 +20,8 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int textcached;     // exec's page cache may hold pages of this file?
+  int nexec;          // processes paging in from this file; see execdup()
 
   short type;         // copy of disk inode
   short major;
@@ -30,11 +32,14 @@ struct inode {
 };
 
 // map major device number to device functions.
+// read() also gets the file offset, which devices
+// without one ignore.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, uint);
   int (*write)(int, uint64, int);
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
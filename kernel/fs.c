@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -22,6 +23,10 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// blocks readi() reads ahead at a time.
+#define NREADAHEAD 8
+
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -162,17 +167,22 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
+// The itable.lock reader-writer spin-lock protects the allocation
+// of itable entries. Since ip->ref indicates whether an entry is
+// free, and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
+// Holding it shared is enough to look entries up, and to change
+// ip->ref with atomic instructions as long as it stays above zero;
+// making an entry free or reusing it needs it held exclusively.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Holding it shared (ilockshared()) is enough to read them, and
+// the inode's contents.
 
 struct {
-  struct spinlock lock;
+  struct rwlock lock;
   struct inode inode[NINODE];
 } itable;
 
@@ -181,7 +191,7 @@ iinit()
 {
   int i = 0;
   
-  initlock(&itable.lock, "itable");
+  initrwlock(&itable.lock, "itable");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
@@ -244,14 +254,26 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&itable.lock);
+  // Usually the inode is already in the table,
+  // which readers can find in parallel.
+  acquireread(&itable.lock);
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&itable.lock);
+      return ip;
+    }
+  }
+  releaseread(&itable.lock);
+
+  acquirewrite(&itable.lock);
 
-  // Is the inode already in the table?
+  // Is the inode in the table now?
   empty = 0;
   for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&itable.lock);
+      releasewrite(&itable.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
@@ -267,7 +289,8 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  ip->textcached = 1;  // don't know; the first execinval() will check.
+  releasewrite(&itable.lock);
 
   return ip;
 }
@@ -277,13 +300,13 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  acquireread(&itable.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&itable.lock);
   return ip;
 }
 
-// Lock the given inode.
+// Lock the given inode exclusively.
 // Reads the inode from disk if necessary.
 void
 ilock(struct inode *ip)
@@ -312,14 +335,37 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading only, so that
+// other readers of it need not wait.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  for(;;){
+    acquiresleepshared(&ip->lock);
+    if(ip->valid)
+      return;
+    // read it in with the lock held exclusively.
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+  }
+}
+
+// Unlock the given inode, locked by ilock() or ilockshared().
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  if(holdingsleep(&ip->lock))
+    releasesleep(&ip->lock);
+  else
+    releasesleepshared(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -332,7 +378,20 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  int ref;
+
+  // dropping a reference that is not the last
+  // only needs itable.lock shared.
+  acquireread(&itable.lock);
+  while((ref = ip->ref) > 1){
+    if(__sync_bool_compare_and_swap(&ip->ref, ref, ref - 1)){
+      releaseread(&itable.lock);
+      return;
+    }
+  }
+  releaseread(&itable.lock);
+
+  acquirewrite(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,7 +400,7 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    releasewrite(&itable.lock);
 
     itrunc(ip);
     ip->type = 0;
@@ -350,11 +409,11 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquirewrite(&itable.lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  releasewrite(&itable.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -413,6 +472,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  execinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -455,7 +516,8 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, ra, end, k;
+  uint rablock[NREADAHEAD];
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -463,7 +525,18 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // read the rest of this read's blocks ahead, NREADAHEAD
+  // at a time, so that the disk can transfer them as one
+  // request while the current one is copied out.
+  end = (off + n + BSIZE - 1) / BSIZE;
+  ra = off/BSIZE + 1;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(ra == off/BSIZE + 1 && ra < end){
+      for(k = 0; k < NREADAHEAD && ra < end; k++, ra++)
+        rablock[k] = bmap(ip, ra);
+      breadahead(ip->dev, rablock, k);
+    }
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -493,6 +566,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  // a process running ip may still page in its old contents.
+  if(ip->nexec > 0)
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -508,6 +584,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off > ip->size)
     ip->size = off;
 
+  // programs started from now on must see the new contents.
+  if(tot > 0)
+    execinval(ip);
+
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
   // block to ip->addrs[].
@@ -636,7 +716,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
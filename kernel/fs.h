@@ -24,6 +24,11 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
+// Most blocks a log transaction can hold: their numbers must
+// fit in the log's header block, after n, seq and sum (see
+// log.c). A log of nlog blocks holds at most nlog-1.
+#define LOGMAXBLOCKS ((BSIZE - 3*sizeof(uint)) / sizeof(uint))
+
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
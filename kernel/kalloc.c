@@ -1,6 +1,14 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so that kalloc()
+// and kfree() on different harts do not contend. A CPU whose
+// list runs dry steals a batch of pages from another CPU.
+//
+// Every page also has a reference count, so that copy-on-write
+// fork can share a page between page tables. kalloc() sets it
+// to one, and kfree() only frees the page when it drops to zero.
 
 #include "types.h"
 #include "param.h"
@@ -14,69 +22,206 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// most pages a CPU takes from another CPU's list at once.
+#define STEALBATCH 64
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;       // pages on freelist
+
+  // statistics, protected by lock.
+  uint64 nalloc;   // pages handed out by kalloc()
+  uint64 nsteal;   // times this CPU refilled from another CPU
+  uint64 nstolen;  // pages taken from other CPUs
+};
+
+struct kmem kmem[NCPU];
+
+// reference counts, indexed by physical page number.
+// only updated with atomic instructions.
+static int kref[(PHYSTOP-KERNBASE)/PGSIZE];
+
+#define PA2REF(pa) (&kref[((uint64)(pa) - KERNBASE) / PGSIZE])
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Hand the initial pages out to the CPUs round-robin,
+// so that no CPU has to steal right after boot.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  struct run *r;
+  int id = 0;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    r = (struct run*)p;
+    acquire(&kmem[id].lock);
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = r;
+    kmem[id].nfree++;
+    release(&kmem[id].lock);
+    id = (id + 1) % NCPU;
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
   struct run *r;
+  int id;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if(__sync_sub_and_fetch(PA2REF(pa), 1) > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  release(&kmem[id].lock);
+  pop_off();
+}
+
+// Take up to half of some other CPU's free pages (at most
+// STEALBATCH) and put them on CPU id's list.
+// Holds only one kmem lock at a time, so two CPUs stealing
+// from each other cannot deadlock.
+// Returns the number of pages stolen.
+static int
+ksteal(int id)
+{
+  struct run *head, *tail;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    struct kmem *victim = &kmem[(id + i) % NCPU];
+
+    acquire(&victim->lock);
+    n = (victim->nfree + 1) / 2;
+    if(n > STEALBATCH)
+      n = STEALBATCH;
+    if(n == 0){
+      release(&victim->lock);
+      continue;
+    }
+    head = tail = victim->freelist;
+    for(int k = 1; k < n; k++)
+      tail = tail->next;
+    victim->freelist = tail->next;
+    victim->nfree -= n;
+    release(&victim->lock);
+
+    acquire(&kmem[id].lock);
+    tail->next = kmem[id].freelist;
+    kmem[id].freelist = head;
+    kmem[id].nfree += n;
+    kmem[id].nsteal++;
+    kmem[id].nstolen += n;
+    release(&kmem[id].lock);
+    return n;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
+// If none is free, asks the buffer cache to give some back.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
 {
   struct run *r;
+  int id;
+
+  for(;;){
+    push_off();
+    id = cpuid();
+    for(;;){
+      acquire(&kmem[id].lock);
+      r = kmem[id].freelist;
+      if(r){
+        kmem[id].freelist = r->next;
+        kmem[id].nfree--;
+        kmem[id].nalloc++;
+      }
+      release(&kmem[id].lock);
+      if(r || ksteal(id) == 0)
+        break;
+    }
+    pop_off();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    // out of memory: take pages back from the buffer cache.
+    if(r || bcacheshrink() == 0)
+      break;
+  }
 
-  if(r)
+  if(r){
+    *PA2REF(r) = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Add a reference to a page returned by kalloc(),
+// e.g. when fork shares it copy-on-write.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  __sync_fetch_and_add(PA2REF(pa), 1);
+}
+
+// Return the number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(PA2REF(pa), __ATOMIC_SEQ_CST);
+}
+
+// Report allocator statistics for the statistics device.
+int
+kmemstats(char *buf, int sz)
+{
+  int n = 0;
+
+  n += snprintf(buf+n, sz-n, "--- kmem\n");
+  for(int i = 0; i < NCPU; i++){
+    struct kmem *k = &kmem[i];
+    if(k->nalloc == 0 && k->lock.n == 0)
+      continue;
+    n += snprintf(buf+n, sz-n,
+                  "cpu %d: free %d alloc %ld steal %ld (%ld pages) lock #acquire %ld #spin %ld\n",
+                  i, k->nfree, k->nalloc, k->nsteal, k->nstolen,
+                  k->lock.n, k->lock.nts);
+  }
+  return n;
+}
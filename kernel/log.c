@@ -10,8 +10,8 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when
+// there are no FS system calls active. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,66 +19,199 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the commit thread has taken the transaction.
+//
+// Commits happen in a kernel thread, committer(), so end_op()
+// does not wait for the disk. Once the last outstanding
+// end_op() has returned, the thread takes the transaction,
+// copies its blocks while no system call can change them,
+// and lets new system calls start a new transaction while it
+// writes the old one to the log and installs it. System calls
+// that finish while a commit is in progress all join the next
+// transaction (group commit). log_force() waits until what
+// has finished so far is on disk, for fsync().
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and a checksum of the header and the blocks
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Its size comes from the superblock (see mkfs -l); a
+// transaction holds one fewer block than the log has, and at
+// most LOGMAXBLOCKS, which is what fits in the header.
+//
+// The commit thread writes the header and the log blocks in
+// one go, without waiting for the blocks before writing the
+// header. A crash can leave a header whose blocks did not all
+// reach the disk; recovery finds that the checksum does not
+// match and ignores the transaction, which had not committed.
+// A header is never erased: replaying the last transaction
+// again is harmless, since nothing newer can have been
+// installed without overwriting the header.
+
+#define NBATCH 16
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;    // transaction number
+  uint sum;    // CRC-32 of the header and the blocks
+  int block[LOGMAXBLOCKS];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int max;         // most blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks they may still log, in all
+  int committing;  // commit thread is copying the transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction
+  struct logheader clh; // the transaction the commit thread has
+  uint64 seq;           // number of the open transaction
+  uint64 committed;     // last transaction that is on disk
+  uint64 closing;       // log_force() wants transaction closing closed
+
+  // statistics, protected by lock.
+  uint64 nop;           // FS system calls
+  uint64 ncommit;       // transactions committed
+  uint64 nblock;        // blocks those transactions wrote
 };
 struct log log;
 
+// the commit thread's buffers: the cached blocks of its
+// transaction, and the private buffers for the copies it
+// writes, which it allocates once and keeps, so that a
+// commit never waits for buffers while system calls wait
+// for it. initlog() sizes them for log.max blocks, in one
+// page.
+static struct buf **home;  // log.max entries
+static struct buf **copy;  // log.max+1 entries
+
+static uint crctab[256];
+
 static void recover_from_log(void);
-static void commit();
+static void committer(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  uint c;
+
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
+  for (int i = 0; i < 256; i++) {
+    c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crctab[i] = c;
+  }
+
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.max = log.size - 1;
+  if (log.max > LOGMAXBLOCKS)
+    log.max = LOGMAXBLOCKS;
+  if (log.max < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  if ((2*log.max + 1) * sizeof(struct buf*) > PGSIZE)
+    panic("initlog: log too big");
+  if ((home = (struct buf**)kalloc()) == 0)
+    panic("initlog: kalloc");
+  copy = home + log.max;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  if(kthread("commit", committer) < 0)
+    panic("initlog: commit thread");
+}
+
+// Add n bytes at p to CRC-32 crc.
+static uint
+crc32(uint crc, void *p, int n)
+{
+  uchar *s = p;
+
+  crc = ~crc;
+  while (n-- > 0)
+    crc = crctab[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Checksum of header h, without h->sum. Adding the
+// contents of its blocks in order gives h->sum.
+static uint
+headsum(struct logheader *h)
+{
+  uint sum;
+
+  sum = crc32(0, &h->n, sizeof(h->n));
+  sum = crc32(sum, &h->seq, sizeof(h->seq));
+  return crc32(sum, h->block, h->n * sizeof(h->block[0]));
+}
+
+// Does the on-disk log hold the whole of the transaction
+// in log.lh? Reads the log blocks into the cache.
+static int
+log_complete(void)
+{
+  uint lblock[NBATCH];
+  uint sum;
+  int tail, i, n;
+
+  if (log.lh.n < 0 || log.lh.n > log.max)
+    return 0;
+  sum = headsum(&log.lh);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > NBATCH)
+      n = NBATCH;
+    for (i = 0; i < n; i++)
+      lblock[i] = log.start+tail+i+1;
+    breadahead(log.dev, lblock, n);
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, lblock[i]);
+      sum = crc32(sum, lbuf->data, BSIZE);
+      brelse(lbuf);
+    }
+  }
+  return sum == log.lh.sum;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Used by recovery; commit() installs from its own copy.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+install_trans(void)
+{
+  struct buf *dbuf[NBATCH];
+  uint lblock[NBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > NBATCH)
+      n = NBATCH;
+    for (i = 0; i < n; i++)
+      lblock[i] = log.start+tail+i+1;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, lblock[i]); // read log block
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bsubmit(dbuf, n);  // start writing dst blocks to disk
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -90,25 +223,21 @@ read_head(void)
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
+  log.lh.seq = lh->seq;
+  log.lh.sum = lh->sum;
+  for (i = 0; i < log.lh.n && i < log.max; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write an empty log header to disk.
 static void
-write_head(void)
+clear_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  hb->n = 0;
   bwrite(buf);
   brelse(buf);
 }
@@ -117,94 +246,199 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  if (log.lh.n > 0 && log_complete())
+    install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  clear_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Most blocks one FS system call may reserve with
+// begin_opn(): the whole log.
+int
+log_maxblocks(void)
+{
+  return log.max;
+}
+
+// called at the start of each FS system call that will
+// write at most nblocks blocks; end it with end_opn(nblocks).
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+  if(nblocks > log.max)
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.closing == log.seq){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > log.max){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
+      log.nop++;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
 
+// called at the end of each FS system call started with
+// begin_opn(nblocks).
+// if this was the last outstanding operation, wakes the
+// commit thread, but does not wait for the commit.
+void
+end_opn(int nblocks)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= nblocks;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0)
+    wakeup(&log.lh);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Wait until the updates of every FS system call that has
+// finished so far are on disk.
+void
+log_force(void)
+{
+  uint64 want;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0){
+    // keep new system calls out of the open transaction,
+    // so that it can commit soon.
+    want = log.seq;
+    log.closing = want;
+  } else {
+    want = log.seq - 1;
   }
+  while(log.committed < want)
+    sleep(&log.committed, &log.lock);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Commit transaction seq, in log.clh: copy its blocks, let
+// new system calls in, write the header and the copies to
+// the log together, and install the copies. Called by
+// committer() with log.committing set, so no system call
+// is running.
 static void
-write_log(void)
+commit(uint64 seq)
 {
-  int tail;
+  struct logheader *h = &log.clh;
+  int i, n = h->n;
+
+  // copy the blocks, in buffers no one else can see.
+  // copy[0] is for the header.
+  for (i = 0; i < n; i++) {
+    home[i] = bread(log.dev, h->block[i]);
+    memmove(copy[i+1]->data, home[i]->data, BSIZE);
+    brelse(home[i]);  // still pinned by log_write()
+  }
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  // write the header and the blocks to the log. the
+  // transaction commits once they are all on disk.
+  h->sum = headsum(h);
+  for (i = 0; i <= n; i++) {
+    copy[i]->blockno = log.start+i;
+    if (i > 0)
+      h->sum = crc32(h->sum, copy[i]->data, BSIZE);
+  }
+  memset(copy[0]->data, 0, BSIZE);
+  memmove(copy[0]->data, h, sizeof(*h));
+  bsubmit(copy, n+1);
+  for (i = 0; i <= n; i++)
+    bwait(copy[i]);
+
+  acquire(&log.lock);
+  log.committed = seq;
+  log.ncommit++;
+  log.nblock += n;
+  wakeup(&log.committed);
+  release(&log.lock);
+
+  // now install writes to home locations. the cached copies
+  // may hold newer updates, which must wait for their own
+  // commit, so write the copies. sort them by block number,
+  // so that neighbouring blocks go to the disk together.
+  for (i = 0; i < n; i++) {
+    struct buf *c = copy[i+1], *hb = home[i];
+    int j;
+    c->blockno = h->block[i];
+    for (j = i; j > 0 && copy[j]->blockno > c->blockno; j--) {
+      copy[j+1] = copy[j];
+      home[j] = home[j-1];
+    }
+    copy[j+1] = c;
+    home[j] = hb;
+  }
+  bsubmit(copy+1, n);
+  for (i = 0; i < n; i++) {
+    bwait(copy[i+1]);
+    bunpin(home[i]);
   }
 }
 
+// The commit thread. Waits for a transaction with updates
+// and no system calls in progress, and commits it.
 static void
-commit()
+committer(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  uint64 seq;
+
+  for (int i = 0; i <= log.max; i++) {
+    copy[i] = bprivate();
+    copy[i]->dev = log.dev;
+  }
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.lh, &log.lock);
+    seq = log.seq++;
+    log.clh = log.lh;
+    log.clh.seq = seq;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.committing = 1;
+    release(&log.lock);
+
+    commit(seq);
+
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +451,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.max)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -234,3 +468,17 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+
+// Report log statistics for the statistics device.
+int
+logstats(char *buf, int sz)
+{
+  int n = 0;
+
+  acquire(&log.lock);
+  n += snprintf(buf+n, sz-n, "--- log\n");
+  n += snprintf(buf+n, sz-n, "ops %ld commits %ld blocks %ld\n",
+                log.nop, log.ncommit, log.nblock);
+  release(&log.lock);
+  return n;
+}
@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +63,25 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   UCLOCK (struct uclock, read-only, the same page in every process)
+//   USYSCALL (struct usyscall, read-only, one page per process)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define UCLOCK (USYSCALL - PGSIZE)
+
+// user memory (p->sz) may not reach above here.
+#define MAXUVA UCLOCK
+
+// the kernel keeps these up to date, so that user code can
+// read them without a system call; see ugetpid() in ulib.c.
+struct usyscall {
+  int pid;        // Process ID
+  int cpu;        // CPU the process is running on
+};
+
+struct uclock {
+  uint ticks;     // what uptime() would return
+  uint64 freq;    // rate of the time CSR, in Hz
+};
@@ -6,8 +6,12 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // max loadable segments in a program
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // data blocks in the log mkfs makes by default
+#define NBUF         (MAXOPBLOCKS*4)  // static disk block cache buffers
+#define NBUFMAX      3000  // most disk block cache buffers, grown with kalloc
+#define FSSIZE       3000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NPRIO        3     // scheduling priority levels, 0 highest
+#define BOOSTTICKS   20    // ticks between priority boosts
@@ -8,15 +8,35 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The data is kept in a ring of pages, which are allocated
+// as the pipe first fills up to them, and freed when it is
+// closed. Copies move whole runs of bytes within a page.
+//
+// pipesplice() puts whole pages of the writer's memory in
+// the ring by reference instead, shared copy-on-write. Such
+// a spliced page is mapped into the reader's page table if
+// it reads the whole page into a page of its own, and
+// otherwise copied out; either way, the pipe drops it once
+// it has been read, rather than reusing it.
+#define PIPEPAGES 4    // most pages of data a pipe holds
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// statistics, updated with atomic instructions.
+static uint64 nspliced;   // pages put in pipes by reference
+static uint64 nremapped;  // of which mapped into a reader
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES]; // byte i is in page[i/PGSIZE % PIPEPAGES]
+  char spliced[PIPEPAGES]; // page is a writer's, by reference
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrwait;     // readers asleep until there is data
+  int nwwait;     // writers asleep until there is room
 };
 
 int
@@ -34,6 +54,12 @@ pipealloc(struct file **f0, struct file **f1)
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->nrwait = 0;
+  pi->nwwait = 0;
+  for(int i = 0; i < PIPEPAGES; i++){
+    pi->page[i] = 0;
+    pi->spliced[i] = 0;
+  }
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -68,63 +94,145 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(int i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// Write n bytes from user address addr to the pipe, moving
+// whole pages by reference if splice is set and they line up.
+static int
+pipeput(struct pipe *pi, uint64 addr, int n, int splice)
 {
-  int i = 0;
+  int i = 0, m, k, whole;
+  uint64 pa;
   struct proc *pr = myproc();
 
+  // copyin() below must not sleep, so it would fail too.
+  if(execprefault(addr, n) < 0)
+    return -1;
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || pr->killed){
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    // can the next page go in by reference?
+    whole = splice && pi->nwrite % PGSIZE == 0 &&
+      (addr + i) % PGSIZE == 0 && n - i >= PGSIZE;
+    k = pi->nwrite / PGSIZE % PIPEPAGES;
+    // wait for room; a spliced page in the way is one the
+    // reader has not finished, and must not be written.
+    if(pi->nwrite == pi->nread + PIPESIZE || pi->spliced[k] ||
+       (whole && pi->nread + PIPESIZE - pi->nwrite < PGSIZE)){ //DOC: pipewrite-full
+      if(pi->nrwait)
+        wakeup(&pi->nread);
+      pi->nwwait++;
       sleep(&pi->nwrite, &pi->lock);
+      pi->nwwait--;
+      continue;
+    }
+    if(whole){
+      if((pa = uvmshare(pr->pagetable, addr + i)) == 0)
+        break;
+      if(pi->page[k])
+        kfree(pi->page[k]);
+      pi->page[k] = (char*)pa;
+      pi->spliced[k] = 1;
+      __sync_fetch_and_add(&nspliced, 1);
+      m = PGSIZE;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // copy what fits in the rest of the page, and
+      // in the room the reader has left.
+      if(pi->page[k] == 0 && (pi->page[k] = kalloc()) == 0)
+        break;
+      m = min(n - i, PGSIZE - pi->nwrite % PGSIZE);
+      m = min(m, pi->nread + PIPESIZE - pi->nwrite);
+      if(copyin(pr->pagetable, pi->page[k] + pi->nwrite % PGSIZE, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
     }
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
+  if(pi->nrwait)
+    wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
+int
+pipewrite(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, addr, n, 0);
+}
+
+// Like pipewrite(), but pages of [addr, addr+n) that fall
+// on page boundaries of the pipe go in by reference.
+int
+pipesplice(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, addr, n, 1);
+}
+
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, k;
   struct proc *pr = myproc();
-  char ch;
 
+  // copyout() below must not sleep, so it would fail too,
+  // after taking the data from the pipe.
+  if(execprefault(addr, n) < 0)
+    return -1;
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
+    pi->nrwait++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->nrwait--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    k = pi->nread / PGSIZE % PIPEPAGES;
+    if(pi->spliced[k] && pi->nread % PGSIZE == 0 && pi->nwrite - pi->nread >= PGSIZE &&
+       (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       uvmreplace(pr->pagetable, addr + i, (uint64)pi->page[k]) == 0){
+      // the reader's page table has the pipe's reference now.
+      pi->page[k] = 0;
+      pi->spliced[k] = 0;
+      __sync_fetch_and_add(&nremapped, 1);
+      m = PGSIZE;
+    } else {
+      m = min(n - i, PGSIZE - pi->nread % PGSIZE);
+      m = min(m, pi->nwrite - pi->nread);
+      if(copyout(pr->pagetable, addr + i, pi->page[k] + pi->nread % PGSIZE, m) == -1)
+        break;
+      if(pi->spliced[k] && (pi->nread + m) % PGSIZE == 0){
+        // don't hold on to the writer's page.
+        kfree(pi->page[k]);
+        pi->page[k] = 0;
+        pi->spliced[k] = 0;
+      }
+    }
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->nwwait)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Report how many pages moved through pipes by reference,
+// for the statistics device.
+int
+pipestats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- pipe\nspliced %ld remapped %ld\n",
+                  nspliced, nremapped);
+}
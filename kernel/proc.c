@@ -12,6 +12,84 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Each CPU has a queue of RUNNABLE processes, so that
+// scheduler() can pick the next process without looking
+// at every proc[] entry. A process goes on the queue of
+// the CPU it last ran on; a CPU whose queue is empty
+// steals from the others.
+// Lock order: p->lock, then a queue's lock.
+//
+// The queue is a multi-level feedback queue: there is a
+// list per priority level, and scheduler() takes from the
+// highest level that is not empty. A process that uses up
+// its quantum at a level moves down one level, so CPU-bound
+// processes sink while interactive ones, which sleep
+// before their quantum is up, stay near the top. Every
+// BOOSTTICKS ticks, clockintr() moves every process back
+// to its base level, so that none starves.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;           // processes on all levels
+  uint epoch;      // boostepoch when last boosted
+
+  // statistics, only updated by the queue's own CPU.
+  uint64 nrun;     // processes this CPU switched to
+  uint64 nsteal;   // of which taken from another CPU's queue
+  uint64 npreempt; // times a higher level preempted a process
+  uint64 nwakeup;  // wakeup() calls on this CPU
+  uint64 nwaiter;  // processes those calls looked at
+};
+
+static struct runq runq[NCPU];
+
+// ticks a process may run at level prio before moving down.
+#define QUANTUM(prio) (1 << (prio))
+
+// incremented by schedboost(); processes and queues
+// that have not caught up with it are boosted.
+static uint boostepoch;
+
+// sleep() puts a process on the wait queue that its channel
+// hashes to, so that wakeup(chan) only has to look at the
+// processes sleeping on chan, and on channels that collide
+// with it.
+// Lock order: p->lock, then a wait queue's lock. wakeup()
+// does not hold a wait queue lock while taking p->lock.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  uint seq;        // processes that have joined, ever
+};
+
+static struct waitq waitq[NWAITQ];
+
+static struct waitq*
+wqhash(void *chan)
+{
+  return &waitq[((uint64)chan >> 3) % NWAITQ];
+}
+
+// Each process's page tables are tagged with ASIDs, so that
+// switching between them needs no TLB flush: the user page
+// table gets an odd ASID, and the kernel page table the one
+// after it. ASID 0 is the kernel page table's. ASIDs are
+// handed out in order, and those of exited processes are not
+// reused, until they run out. Then a new generation starts,
+// numbering from 1 again. A process with ASIDs from an older
+// generation gets new ones before it next runs, and a CPU
+// flushes its whole TLB before it first runs a process with
+// ASIDs from a newer generation, since the TLB may hold
+// translations for the same ASIDs from an older one.
+struct {
+  struct spinlock lock;
+  uint64 gen;      // current generation
+  int next;        // next ASID to hand out in gen
+} asids;
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
@@ -50,6 +128,13 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&asids.lock, "asids");
+  asids.gen = 1;
+  asids.next = 1;
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -97,6 +182,57 @@ allocpid() {
   return pid;
 }
 
+// Give p a pair of ASIDs from the current generation,
+// starting a new one if they have run out.
+static void
+asidalloc(struct proc *p)
+{
+  acquire(&asids.lock);
+  if(asids.next + 1 >= nasid){
+    __atomic_store_n(&asids.gen, asids.gen + 1, __ATOMIC_RELEASE);
+    asids.next = 1;
+  }
+  p->asid = asids.next;
+  p->asidgen = asids.gen;
+  asids.next += 2;
+  release(&asids.lock);
+  p->tlbcpu = -1;
+}
+
+// Make p's ASIDs good to use on CPU c (whose id is id),
+// which is about to run p. The TLB holds nothing for new
+// ASIDs, once it has been flushed for their generation. But
+// it may hold stale translations of p's from when p last
+// ran on c, since a process flushes only the TLB of the
+// CPU that it changes its page tables on.
+static void
+asidcheck(struct proc *p, struct cpu *c, int id)
+{
+  if(p->asidgen != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    asidalloc(p);
+    p->trapframe->kernel_satp = MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid + 1);
+  }
+  if(c->asidgen != p->asidgen){
+    sfence_vma();
+    c->asidgen = p->asidgen;
+  } else if(p->tlbcpu != id){
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(p->asid + 1);
+  }
+  p->tlbcpu = id;
+}
+
+// Set up what uservec needs in p's trapframe to enter the
+// kernel. Only kernel_hartid changes while p exists, if p
+// moves to another CPU; see scheduler().
+static void
+trapframeinit(struct proc *p)
+{
+  p->trapframe->kernel_satp = MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid + 1);
+  p->trapframe->kernel_sp = p->kstack + PGSIZE;
+  p->trapframe->kernel_trap = (uint64)usertrap;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -119,6 +255,10 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
+  p->prio = p->baseprio = 0;
+  p->ticks = 0;
+  p->epoch = __atomic_load_n(&boostepoch, __ATOMIC_RELAXED);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -127,6 +267,16 @@ found:
     return 0;
   }
 
+  // Allocate the page of data user code reads directly.
+  if((p->usyscall = (struct usyscall *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  memset(p->usyscall, 0, PGSIZE);
+  p->usyscall->pid = p->pid;
+  p->usyscall->cpu = p->cpu;
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -135,6 +285,14 @@ found:
     return 0;
   }
 
+  // The kernel page table to use while running it.
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  trapframeinit(p);
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -153,10 +311,23 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
+  // retire p's ASIDs until the next generation.
+  p->asid = 0;
+  p->asidgen = 0;
   p->sz = 0;
+  p->execsz = 0;
+  p->kfunc = 0;
+  p->ring = 0;
+  p->nexecseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -168,11 +339,16 @@ freeproc(struct proc *p)
 
 // Create a user page table for a given process,
 // with no user memory, but with trampoline pages.
+// A new process also gets its ASIDs here; exec()
+// keeps them for its new page table.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
   pagetable_t pagetable;
 
+  if(p->asid == 0)
+    asidalloc(p);
+
   // An empty page table.
   pagetable = uvmcreate();
   if(pagetable == 0)
@@ -196,6 +372,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the pages user code reads instead of calling
+  // getpid() and uptime(), just below TRAPFRAME.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  if(mappages(pagetable, UCLOCK, PGSIZE,
+              (uint64)uclock, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, USYSCALL, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -206,6 +400,8 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmunmap(pagetable, UCLOCK, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -242,26 +438,66 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfunc();
+  panic("kthread returned");
+}
+
+// Start a kernel thread that runs fn(), which must not
+// return. It has no user memory and never leaves the
+// kernel, but sleeps and is scheduled like any process.
+// Must be called from a process, not from main().
+// Returns the thread's pid, or -1.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
 
+  if((p = allocproc()) == 0)
+    return -1;
+  p->kfunc = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  setrunnable(p);
   release(&p->lock);
+  return pid;
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; the pages are
+// allocated on first touch, by uvmfault().
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > MAXUVA)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(p->execsz > sz)
+      p->execsz = sz;  // regrown memory must be zero, not program
   }
   p->sz = sz;
   return 0;
@@ -291,6 +527,7 @@ fork(void)
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
+  trapframeinit(np);
 
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
@@ -300,9 +537,17 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  np->ring = p->ring;
+  if(p->execip)
+    np->execip = execdup(p->execip);
+  np->execsz = p->execsz;
+  np->nexecseg = p->nexecseg;
+  memmove(np->execseg, p->execseg, sizeof(p->execseg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->prio = np->baseprio = p->baseprio;
+
   pid = np->pid;
 
   release(&np->lock);
@@ -312,7 +557,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -355,8 +600,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    execput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -387,6 +635,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // copyout() below must not sleep, so it would fail too,
+  // after freeing the child.
+  if(addr != 0 && execprefault(addr, sizeof(int)) < 0)
+    return -1;
   acquire(&wait_lock);
 
   for(;;){
@@ -427,10 +679,191 @@ wait(uint64 addr)
   }
 }
 
+// If a CPU is halted in scheduler(), wake it with an
+// ipi() to run what was just put on CPU id's queue at
+// level prio: preferably CPU id itself, or else one that
+// will steal. If none is halted, interrupt CPU id if it
+// is running a process of lower priority, so that
+// preempt() switches to the new one now rather than at
+// the next tick.
+static void
+kick(int id, int prio)
+{
+  struct proc *q;
+
+  // pairs with the barrier in halt(): either the halting
+  // CPU sees the queued process, or we see it idle.
+  __sync_synchronize();
+  for(int i = 0; i < NCPU; i++){
+    struct cpu *c = &cpus[(id + i) % NCPU];
+    // the swap keeps two CPUs from both waking c.
+    if(c->idle && __sync_lock_test_and_set(&c->idle, 0)){
+      ipi((id + i) % NCPU);
+      return;
+    }
+  }
+
+  // only a hint, read without q->lock, which we may not
+  // take while holding another proc's lock.
+  q = cpus[id].proc;
+  if(q != 0 && q->prio > prio)
+    ipi(id);
+}
+
+// Catch p up with any boost since it last ran: move it
+// back to its base level, with a fresh quantum.
+// Caller must hold p->lock.
+static void
+boost(struct proc *p)
+{
+  uint epoch = __atomic_load_n(&boostepoch, __ATOMIC_RELAXED);
+
+  if(p->epoch != epoch){
+    p->epoch = epoch;
+    p->prio = p->baseprio;
+    p->ticks = 0;
+  }
+}
+
+// Catch rq up with any boost: move each process below
+// its base level to the tail of that level, in order.
+// The processes' own prio fields catch up when they next
+// run. p->baseprio is read without p->lock, which we may
+// not take while holding rq->lock; if setpriority() races
+// with us, boost() still puts p right once it runs.
+// Caller must hold rq->lock.
+static void
+runqboost(struct runq *rq)
+{
+  uint epoch = __atomic_load_n(&boostepoch, __ATOMIC_RELAXED);
+  struct proc *p, *next, *keep, *last;
+  int base;
+
+  if(rq->epoch == epoch)
+    return;
+  rq->epoch = epoch;
+  for(int i = 1; i < NPRIO; i++){
+    keep = last = 0;
+    for(p = rq->head[i]; p; p = next){
+      next = p->rqnext;
+      p->rqnext = 0;
+      base = p->baseprio;
+      if(base >= i){
+        // at its base level already.
+        if(last)
+          last->rqnext = p;
+        else
+          keep = p;
+        last = p;
+        continue;
+      }
+      if(rq->tail[base])
+        rq->tail[base]->rqnext = p;
+      else
+        rq->head[base] = p;
+      rq->tail[base] = p;
+    }
+    rq->head[i] = keep;
+    rq->tail[i] = last;
+  }
+}
+
+// Mark p RUNNABLE and put it at the tail of level
+// p->prio of the run queue of CPU p->cpu.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  boost(p);
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  acquire(&rq->lock);
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+  release(&rq->lock);
+  kick(p->cpu, p->prio);
+}
+
+// Take the process at the head of the highest non-empty
+// level of rq, or return 0.
+static struct proc*
+runqget(struct runq *rq)
+{
+  struct proc *p = 0;
+
+  acquire(&rq->lock);
+  runqboost(rq);
+  for(int i = 0; i < NPRIO; i++){
+    if((p = rq->head[i]) != 0){
+      rq->head[i] = p->rqnext;
+      if(rq->head[i] == 0)
+        rq->tail[i] = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Find a process for CPU id to run: the head of its own
+// queue, or else one stolen from another CPU's queue.
+static struct proc*
+pickproc(int id)
+{
+  struct proc *p;
+
+  if((p = runqget(&runq[id])) != 0)
+    return p;
+  for(int i = 1; i < NCPU; i++){
+    struct runq *rq = &runq[(id + i) % NCPU];
+    // peek without the lock, to avoid taking the locks
+    // of idle CPUs' empty queues over and over.
+    if(rq->n > 0 && (p = runqget(rq)) != 0){
+      runq[id].nsteal++;
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Halt CPU c with wfi until an interrupt arrives,
+// unless some run queue has a process in it.
+static void
+halt(struct cpu *c)
+{
+  uint64 t0;
+
+  // with interrupts off, an ipi() between the check
+  // and wfi stays pending, and wfi returns at once.
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  for(int i = 0; i < NCPU; i++){
+    if(runq[i].n > 0){
+      c->idle = 0;
+      return;
+    }
+  }
+  t0 = r_time();
+  wfi();
+  c->idletime += r_time() - t0;
+  c->idle = 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this CPU's run queue,
+//    or another CPU's, or halt until there is one.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -439,28 +872,46 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
+  c->starttime = r_time();
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = pickproc(id)) == 0){
+      halt(c);
+      continue;
     }
+
+    // p is on no queue now, so no other CPU can pick it,
+    // but the CPU it last ran on may still be switching
+    // away from it: acquiring p->lock waits for that.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    p->usyscall->cpu = id;
+    p->trapframe->kernel_hartid = id;
+    c->proc = p;
+    runq[id].nrun++;
+
+    // Run p on its own kernel page table.
+    asidcheck(p, c, id);
+    w_satp(p->trapframe->kernel_satp);
+    swtch(&c->context, &p->context);
+    kvmswitch();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -497,11 +948,83 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Called by the trap handlers for each clock interrupt
+// (tick is 1) and each ipi() (tick is 0) that arrives
+// while a process is running. Charge the process for the
+// tick, and give up the CPU if it has used up its quantum,
+// moving down a level, or if a process of higher priority
+// is waiting on this CPU's queue.
+void
+preempt(int tick)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  int prio;
+
+  acquire(&p->lock);
+  boost(p);
+  if(tick && ++p->ticks >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->ticks = 0;
+    setrunnable(p);
+    sched();
+  } else {
+    // peek without the lock; a process missed
+    // here is seen at the next tick.
+    rq = &runq[p->cpu];
+    for(prio = 0; prio < p->prio; prio++)
+      if(rq->head[prio] != 0)
+        break;
+    if(prio < p->prio){
+      rq->npreempt++;
+      setrunnable(p);
+      sched();
+    }
+  }
+  release(&p->lock);
+}
+
+// Move every process back to its base priority level.
+// Called by clockintr() every BOOSTTICKS ticks; the
+// processes and queues catch up lazily.
+void
+schedboost(void)
+{
+  __sync_fetch_and_add(&boostepoch, 1);
+}
+
+// Set the base priority level of process pid, and move
+// it to that level with a fresh quantum. It keeps the
+// level until it uses up its quantum there.
+// Returns -1 if there is no such process, or prio is
+// not a level.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->baseprio = prio;
+      p->prio = prio;
+      p->ticks = 0;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -529,7 +1052,20 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = wqhash(chan);
   
+  // Join chan's wait queue while still holding lk, so
+  // that a wakeup() after lk is released finds p there.
+  acquire(&wq->lock);
+  p->wchan = chan;
+  p->wqseq = ++wq->seq;
+  p->wqprev = 0;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqprev = p;
+  wq->head = p;
+  release(&wq->lock);
+
   // Must acquire p->lock in order to
   // change p->state and then call sched.
   // Once we hold p->lock, we can be
@@ -540,14 +1076,30 @@ sleep(void *chan, struct spinlock *lk)
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
-  // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
+  // Go to sleep, unless a wakeup() has taken p off the
+  // queue already. One that takes it off from here on
+  // waits for p->lock, and so finds p SLEEPING.
+  if(__atomic_load_n(&p->wchan, __ATOMIC_ACQUIRE) != 0){
+    p->chan = chan;
+    p->state = SLEEPING;
 
-  sched();
+    sched();
 
-  // Tidy up.
-  p->chan = 0;
+    // Tidy up.
+    p->chan = 0;
+  }
+
+  acquire(&wq->lock);
+  if(p->wchan){
+    if(p->wqprev)
+      p->wqprev->wqnext = p->wqnext;
+    else
+      wq->head = p->wqnext;
+    if(p->wqnext)
+      p->wqnext->wqprev = p->wqprev;
+    p->wchan = 0;
+  }
+  release(&wq->lock);
 
   // Reacquire original lock.
   release(&p->lock);
@@ -560,16 +1112,52 @@ void
 wakeup(void *chan)
 {
   struct proc *p;
+  struct waitq *wq = wqhash(chan);
+  int n = 0, id;
+  uint seq;
+
+  // take the processes on chan's wait queue off it one at
+  // a time, and wake each without the queue's lock held:
+  // sleep() takes it while holding p->lock. only those
+  // that joined before we started, so that processes
+  // that wake and sleep again can't keep us here.
+  acquire(&wq->lock);
+  seq = wq->seq;
+  for(;;){
+    for(p = wq->head; p; p = p->wqnext){
+      if(p->wchan == chan && p != myproc() && (int)(p->wqseq - seq) <= 0)
+        break;
+    }
+    if(p == 0)
+      break;
+    if(p->wqprev)
+      p->wqprev->wqnext = p->wqnext;
+    else
+      wq->head = p->wqnext;
+    if(p->wqnext)
+      p->wqnext->wqprev = p->wqprev;
+    __atomic_store_n(&p->wchan, 0, __ATOMIC_RELEASE);
+    release(&wq->lock);
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+    acquire(&p->lock);
+    // p may not have gone to sleep yet, in which case it
+    // sees that it is off the queue and doesn't; or it
+    // may have woken, and gone to sleep on chan again.
+    if(p->state == SLEEPING && p->chan == chan) {
+      setrunnable(p);
     }
+    release(&p->lock);
+    n++;
+
+    acquire(&wq->lock);
   }
+  release(&wq->lock);
+
+  push_off();
+  id = cpuid();
+  runq[id].nwakeup++;
+  runq[id].nwaiter += n;
+  pop_off();
 }
 
 // Kill the process with the given pid.
@@ -586,7 +1174,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -654,3 +1242,54 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Report scheduler statistics for the statistics device.
+int
+schedstats(char *buf, int sz)
+{
+  uint64 nwakeup = 0, nwaiter = 0, nacq = 0, nspin = 0;
+  int n = 0;
+
+  n += snprintf(buf+n, sz-n, "--- sched\n");
+  for(int i = 0; i < NCPU; i++){
+    struct runq *rq = &runq[i];
+    nwakeup += rq->nwakeup;
+    nwaiter += rq->nwaiter;
+    if(rq->nrun == 0)
+      continue;
+    n += snprintf(buf+n, sz-n,
+                  "cpu %d: runs %ld steals %ld preempts %ld queued %d lock #acquire %ld #spin %ld\n",
+                  i, rq->nrun, rq->nsteal, rq->npreempt, rq->n,
+                  rq->lock.n, rq->lock.nts);
+  }
+  for(int i = 0; i < NWAITQ; i++){
+    nacq += waitq[i].lock.n;
+    nspin += waitq[i].lock.nts;
+  }
+  n += snprintf(buf+n, sz-n,
+                "wakeups %ld waiters %ld waitq lock #acquire %ld #spin %ld\n",
+                nwakeup, nwaiter, nacq, nspin);
+  n += snprintf(buf+n, sz-n, "asid generation %ld next %d of %d\n",
+                asids.gen, asids.next, nasid);
+  return n;
+}
+
+// Report how many cycles each CPU has spent halted in
+// scheduler(), and how many doing anything else, for the
+// statistics device.
+int
+cpustats(char *buf, int sz)
+{
+  uint64 now = r_time();
+  int n = 0;
+
+  n += snprintf(buf+n, sz-n, "--- cpu\n");
+  for(int i = 0; i < NCPU; i++){
+    struct cpu *c = &cpus[i];
+    if(c->starttime == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "cpu %d: idle %ld busy %ld\n",
+                  i, c->idletime, now - c->starttime - c->idletime);
+  }
+  return n;
+}
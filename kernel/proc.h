@@ -24,6 +24,10 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // Halted in scheduler(), waiting for an ipi()?
+  uint64 asidgen;             // ASID generation of the TLB's translations
+  uint64 starttime;           // time (in cycles) scheduler() started
+  uint64 idletime;            // cycles spent halted since then
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,9 +39,10 @@ extern struct cpu cpus[NCPU];
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
-// usertrapret() and userret in trampoline.S set up
-// the trapframe's kernel_*, restore user registers from the
-// trapframe, switch to the user page table, and enter user space.
+// allocproc() and scheduler() set up the trapframe's kernel_*.
+// usertrapret() and userret in trampoline.S restore user
+// registers from the trapframe, switch to the user page table,
+// and enter user space.
 // the trapframe includes callee-saved user registers like s0-s11 because the
 // return-to-user path via usertrapret() doesn't return through
 // the entire kernel call stack.
@@ -80,6 +85,17 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable segment of the program a process is running.
+// exec() does not read it in; its pages are read from
+// p->execip on first touch, by execfault().
+struct execseg {
+  uint64 va;                   // Page-aligned start address
+  uint64 memsz;                // Size in memory
+  uint64 filesz;               // Bytes that come from the file
+  uint64 off;                  // Offset of va in the file
+  int perm;                    // PTE_R, PTE_W, PTE_X, PTE_U
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -92,6 +108,18 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue it goes on
+  struct proc *rqnext;         // Next on that run queue
+  int prio;                    // Current priority level, 0 highest
+  int baseprio;                // Level it returns to at a boost
+  int ticks;                   // Ticks used at prio so far
+  uint epoch;                  // Boost that last reset prio
+
+  // the lock of the wait queue for wchan protects these:
+  void *wchan;                 // Channel of the wait queue it is on, or 0
+  struct proc *wqnext;         // Links in that wait queue
+  struct proc *wqprev;
+  uint wqseq;                  // When it joined, for wakeup()
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -100,9 +128,20 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, mirroring pagetable
+  int asid;                    // ASID of pagetable; kpagetable's is asid+1
+  uint64 asidgen;              // Generation asid is from; see asidalloc()
+  int tlbcpu;                  // CPU p last ran on, or -1; see asidcheck()
+  struct inode *execip;        // Program file, for paging in
+  uint64 execsz;               // End of program image; pages below come from execip
+  int nexecseg;                // Number of entries in execseg
+  struct execseg execseg[NEXECSEG];
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // data page mapped read-only at USYSCALL
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  uint64 ring;                 // User address of struct ring, or 0
+  void (*kfunc)(void);         // Body of a kernel thread, else 0
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,55 @@
+// Submission and completion rings, for queueing file system
+// calls and performing a batch of them in one trap; see
+// ringsetup() and ringenter() in sysfile.c.
+//
+// A struct ring lives in the process's own memory. The
+// process fills in sq[sqtail % NSQE] and then advances sqtail.
+// The kernel performs entries from sqhead on, posting each
+// result at cq[cqtail % NCQE], and advances sqhead and cqtail.
+// The process takes results from cqhead on, and advances it.
+// The kernel stops when the completion ring is full.
+//
+// With RING_POLL, the kernel also performs entries at the
+// process's clock ticks, but stops at the first one that
+// could block for long: RING_OPEN, or a read or write of
+// a pipe or device. That one waits for ringenter().
+
+#define NSQE 64
+#define NCQE 64
+
+// submission ops.
+#define RING_NOP   0
+#define RING_READ  1  // read(fd, addr, n)
+#define RING_WRITE 2  // write(fd, addr, n)
+#define RING_OPEN  3  // open(addr, n)
+#define RING_CLOSE 4  // close(fd)
+#define RING_FSTAT 5  // fstat(fd, addr)
+
+// ring flags.
+#define RING_POLL  0x1  // also perform entries at each clock tick
+
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;     // buffer, path or struct stat
+  int n;           // byte count, or mode for RING_OPEN
+  int pad;
+  uint64 data;     // copied to the completion
+};
+
+struct cqe {
+  uint64 data;     // from the submission
+  int res;         // what the system call would have returned
+  int pad;
+};
+
+struct ring {
+  uint sqhead;     // advanced by the kernel
+  uint sqtail;     // advanced by the process
+  uint cqhead;     // advanced by the process
+  uint cqtail;     // advanced by the kernel
+  uint flags;
+  uint pad[3];
+  struct sqe sq[NSQE];
+  struct cqe cq[NCQE];
+};
@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User memory
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -195,9 +196,15 @@ w_pmpaddr0(uint64 x)
 
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
+#define SATP_ASIDMASK 0xFFFFL
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// tag a satp value with an address-space ID, so that the TLB
+// can hold translations for several page tables at once, and
+// switching between them needs no sfence.vma.
+#define SATP_ASID(asid) ((((uint64)(asid)) & SATP_ASIDMASK) << 44)
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -260,6 +267,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -269,6 +291,14 @@ r_time()
   return x;
 }
 
+// wait until an interrupt is pending, even if
+// interrupts are disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -331,6 +361,21 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries for address space asid.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for virtual address va
+// in address space asid.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -343,6 +388,7 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_COW (1L << 8) // copy-on-write; uses a bit reserved for software
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -0,0 +1,94 @@
+// Reader-writer spin locks, for data that is read far more
+// often than it is written. Like spinlocks, they are held
+// with interrupts off and must not be held across sleep().
+// A waiting writer holds off new readers, so that a stream
+// of readers cannot starve it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  rw->name = name;
+  rw->state = 0;
+  rw->wwait = 0;
+  rw->cpu = 0;
+}
+
+// Acquire rw shared, with other readers.
+void
+acquireread(struct rwlock *rw)
+{
+  uint s;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(rw))
+    panic("acquireread");
+
+  for(;;){
+    s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    if((s & RW_WRITER) == 0 && __atomic_load_n(&rw->wwait, __ATOMIC_RELAXED) == 0 &&
+       __sync_bool_compare_and_swap(&rw->state, s, s + 1))
+      break;
+  }
+
+  // the critical section's memory references must
+  // happen strictly after the lock is acquired.
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  if((rw->state & RW_WRITER) || rw->state == 0)
+    panic("releaseread");
+
+  // the atomic add includes a fence, so the critical
+  // section's references happen before the release.
+  __sync_fetch_and_sub(&rw->state, 1);
+  pop_off();
+}
+
+// Acquire rw exclusively, once every reader has left.
+void
+acquirewrite(struct rwlock *rw)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(rw))
+    panic("acquirewrite");
+
+  __sync_fetch_and_add(&rw->wwait, 1);
+  while(!__sync_bool_compare_and_swap(&rw->state, 0, RW_WRITER))
+    ;
+  __sync_fetch_and_sub(&rw->wwait, 1);
+
+  __sync_synchronize();
+  rw->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  if(!holdingwrite(rw))
+    panic("releasewrite");
+
+  rw->cpu = 0;
+  __sync_synchronize();
+  __atomic_store_n(&rw->state, 0, __ATOMIC_RELAXED);
+  pop_off();
+}
+
+// Check whether this cpu holds rw exclusively.
+// Interrupts must be off.
+int
+holdingwrite(struct rwlock *rw)
+{
+  return rw->state == RW_WRITER && rw->cpu == mycpu();
+}
@@ -0,0 +1,12 @@
+// Reader-writer spin lock: held by any number of readers,
+// or by one writer.
+struct rwlock {
+  uint state;        // Number of readers, or RW_WRITER.
+  uint wwait;        // Writers waiting; new readers wait too.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding it exclusively.
+};
+
+#define RW_WRITER 0x80000000
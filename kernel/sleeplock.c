@@ -1,4 +1,11 @@
 // Sleeping locks
+//
+// A process that finds a lock held exclusively by a process
+// running on another CPU first spins for a while, since the
+// owner often lets go within microseconds (e.g. after a
+// memmove into a buffer), and a sleep() and wakeup() would
+// cost two context switches. It sleeps if the owner is not
+// running, or does not let go soon enough.
 
 #include "types.h"
 #include "riscv.h"
@@ -9,24 +16,95 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// times to look at the lock before giving up and sleeping.
+#define SPINMAX 2000
+
+// statistics, per CPU, updated with some lock's lk held.
+static struct {
+  uint64 n;        // acquisitions
+  uint64 nspun;    // of which had to spin, but not sleep
+  uint64 nslept;   // of which slept
+} slstats[NCPU];
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->sleepers = 0;
   lk->pid = 0;
+  lk->owner = 0;
+}
+
+// Wait for the exclusive owner of lk to release it, as long
+// as the owner is running, for at most SPINMAX looks.
+// Called and returns with lk->lk held, but releases it
+// while spinning.
+static void
+spinwait(struct sleeplock *lk)
+{
+  struct proc *owner = lk->owner;
+
+  // owner->state is only a hint here, read
+  // without owner->lock. a process waiting
+  // for itself would spin for nothing.
+  if(owner == 0 || owner == myproc() || owner->state != RUNNING)
+    return;
+  release(&lk->lk);
+  for(int i = 0; i < SPINMAX; i++){
+    if(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) == 0 ||
+       lk->owner != owner || owner->state != RUNNING)
+      break;
+  }
+  acquire(&lk->lk);
+}
+
+// Sleep until lk may be free. Called with lk->lk held.
+static void
+waitsleep(struct sleeplock *lk)
+{
+  lk->sleepers++;
+  sleep(lk, &lk->lk);
+  lk->sleepers--;
+}
+
+// Count an acquisition. Called with lk->lk held.
+static void
+count(int spun, int slept)
+{
+  int id = cpuid();
+
+  slstats[id].n++;
+  if(slept)
+    slstats[id].nslept++;
+  else if(spun)
+    slstats[id].nspun++;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int spun = 0, slept = 0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  lk->wwait++;
+  while (lk->locked || lk->readers) {
+    if(!spun && lk->locked){
+      spun = 1;
+      spinwait(lk);
+      continue;
+    }
+    slept = 1;
+    waitsleep(lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  count(spun, slept);
   release(&lk->lk);
 }
 
@@ -36,7 +114,59 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  if(lk->sleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Acquire lk shared with other readers. Waits while a
+// writer holds it or is waiting for it, so that readers
+// cannot starve writers. A process must not acquire a
+// lock shared that it already holds.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  int spun = 0, slept = 0;
+
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    if(!spun && lk->locked){
+      spun = 1;
+      spinwait(lk);
+      continue;
+    }
+    slept = 1;
+    waitsleep(lk);
+  }
+  lk->readers++;
+  count(spun, slept);
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  if(--lk->readers == 0 && lk->sleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Give lk, held exclusively by this process, to whatever
+// will release it later, such as a disk interrupt handler.
+// It then has no owner, so waiters sleep instead of
+// spinning on a process that may run on for a long time.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(!lk->locked || lk->owner != myproc())
+    panic("disownsleep");
+  lk->pid = 0;
+  lk->owner = 0;
   release(&lk->lk);
 }
 
@@ -51,5 +181,18 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Report how many sleep lock acquisitions had to spin or
+// sleep, for the statistics device.
+int
+sleeplockstats(char *buf, int sz)
+{
+  uint64 n = 0, nspun = 0, nslept = 0;
 
-
+  for(int i = 0; i < NCPU; i++){
+    n += slstats[i].n;
+    nspun += slstats[i].nspun;
+    nslept += slstats[i].nslept;
+  }
+  return snprintf(buf, sz, "--- sleeplock\nacquires %ld spun %ld slept %ld\n",
+                  n, nspun, nslept);
+}
@@ -8,12 +8,38 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every lock in the kernel's static data, for lockstats().
+// Locks in kalloc()ed memory, like pipes' and those of the
+// buffers the cache grows, are not recorded, since they
+// may be freed.
+#define NLOCK 500
+#define NTOP 10    // lock names lockstats() reports
+
+static struct {
+  struct spinlock lock;
+  struct spinlock *lk[NLOCK];
+  int n;
+} locks = { .lock = { .name = "locks" } };
+
+extern char end[]; // first address after kernel.
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->maxhold = 0;
+
+  if((char*)lk < end){
+    acquire(&locks.lock);
+    if(locks.n < NLOCK)
+      locks.lk[locks.n++] = lk;
+    release(&locks.lock);
+  }
 }
 
 // Acquire the lock.
@@ -21,16 +47,24 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  //   s1 = &lk->next
+  //   amoadd.w a5, a5, (s1)
+  // waiters then only read owner, so its cache line is not
+  // written while they spin, until release() hands it on.
+  __sync_fetch_and_add(&lk->n, 1);
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket)
+    spins++;
+  if(spins)
+    __sync_fetch_and_add(&lk->nts, spins);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +74,21 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->start = r_time();
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint64 held;
+
   if(!holding(lk))
     panic("release");
 
+  held = r_time() - lk->start;
+  if(held > lk->maxhold)
+    lk->maxhold = held;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +99,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Hand the lock to the next ticket. Only the holder writes
+  // owner, but this doesn't use a plain C assignment, since the
+  // C standard implies that an assignment might be implemented
+  // with multiple store instructions.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
 
   pop_off();
 }
@@ -77,10 +114,54 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->next != lk->owner && lk->cpu == mycpu());
   return r;
 }
 
+// Report the NTOP locks that were waited for the most, adding
+// up those with the same name, for the statistics device.
+int
+lockstats(char *buf, int sz)
+{
+  // one per lock name.
+  static struct {
+    char *name;
+    uint64 n, nts, maxhold;
+  } cls[NLOCK];
+  int ncls = 0, n = 0, i, j;
+
+  acquire(&locks.lock);
+  for(i = 0; i < locks.n; i++){
+    struct spinlock *lk = locks.lk[i];
+    for(j = 0; j < ncls; j++)
+      if(strncmp(cls[j].name, lk->name, 32) == 0)
+        break;
+    if(j == ncls){
+      cls[ncls].name = lk->name;
+      cls[ncls].n = cls[ncls].nts = cls[ncls].maxhold = 0;
+      ncls++;
+    }
+    cls[j].n += lk->n;
+    cls[j].nts += lk->nts;
+    if(lk->maxhold > cls[j].maxhold)
+      cls[j].maxhold = lk->maxhold;
+  }
+
+  n += snprintf(buf+n, sz-n, "--- lock\n");
+  // selection sort by #spin, most first.
+  for(i = 0; i < ncls && i < NTOP; i++){
+    int m = i;
+    for(j = i+1; j < ncls; j++)
+      if(cls[j].nts > cls[m].nts)
+        m = j;
+    n += snprintf(buf+n, sz-n, "%s: #acquire %ld #spin %ld max hold %ld\n",
+                  cls[m].name, cls[m].n, cls[m].nts, cls[m].maxhold);
+    cls[m] = cls[i];
+  }
+  release(&locks.lock);
+  return n;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
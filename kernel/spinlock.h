@@ -1,9 +1,19 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire() takes the next ticket and waits
+// until owner reaches it, so CPUs get the lock in the order
+// they asked for it.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now allowed to hold the lock.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For contention statistics:
+  uint64 n;          // Number of acquire() calls.
+  uint64 nts;        // Number of times round the wait loop.
+  uint64 start;      // When the holder acquired it (cycles).
+  uint64 maxhold;    // Longest time it has been held (cycles).
 };
 
@@ -0,0 +1,114 @@
+//
+// formatted output into a buffer, for the statistics device.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int
+sputc(char *s, char c)
+{
+  *s = c;
+  return 1;
+}
+
+static int
+sprintint(char *s, uint64 xx, int base, int sign)
+{
+  char buf[24];
+  int i, n;
+  uint64 x;
+
+  if(sign && (sign = (long)xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[i++] = '-';
+
+  n = 0;
+  while(--i >= 0)
+    n += sputc(s+n, buf[i]);
+  return n;
+}
+
+// Print to the buffer buf of size sz. Only understands
+// %d, %x, %p, %s, and %ld, %lx for 64-bit values.
+// Returns the number of characters written, not
+// counting the terminating nul.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, l;
+  int off = 0;
+  uint64 x;
+  char *s;
+
+  if(sz <= 0)
+    return 0;
+
+  va_start(ap, fmt);
+  for(i = 0; off < sz - 24 && (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off += sputc(buf+off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    l = 0;
+    if(c == 'l'){
+      l = 1;
+      c = fmt[++i] & 0xff;
+    }
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      x = l ? va_arg(ap, uint64) : (uint64)(long)va_arg(ap, int);
+      off += sprintint(buf+off, x, 10, 1);
+      break;
+    case 'x':
+      x = l ? va_arg(ap, uint64) : (uint64)va_arg(ap, uint);
+      off += sprintint(buf+off, x, 16, 0);
+      break;
+    case 'p':
+      off += sputc(buf+off, '0');
+      off += sputc(buf+off, 'x');
+      off += sprintint(buf+off, va_arg(ap, uint64), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s && off < sz - 1; s++)
+        off += sputc(buf+off, *s);
+      break;
+    case '%':
+      off += sputc(buf+off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off += sputc(buf+off, '%');
+      off += sputc(buf+off, c);
+      break;
+    }
+  }
+  va_end(ap);
+  buf[off] = 0;
+  return off;
+}
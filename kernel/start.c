@@ -11,7 +11,7 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
@@ -43,6 +43,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor and user mode read the time CSR.
+  w_mcounteren(r_mcounteren() | 2);
+  w_scounteren(r_scounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -54,9 +58,10 @@ start()
   asm volatile("mret");
 }
 
-// set up to receive timer interrupts in machine mode,
-// which arrive at timervec in kernelvec.S,
-// which turns them into software interrupts for
+// set up to receive timer interrupts, and software
+// interrupts that other CPUs send with ipi(), in machine
+// mode. both arrive at timervec in kernelvec.S, which
+// turns them into supervisor software interrupts for
 // devintr() in trap.c.
 void
 timerinit()
@@ -72,9 +77,13 @@ timerinit()
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
   // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : set by timervec for each tick; see clockpending().
+  // scratch[6] : address of CLINT MSIP register.
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[5] = 0;
+  scratch[6] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -83,6 +92,17 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// Did timervec raise the current supervisor software
+// interrupt for a clock tick, rather than only for an IPI?
+// Called by devintr(), in supervisor mode.
+int
+clockpending(void)
+{
+  // swap atomically: timervec may run between
+  // instructions, even with interrupts off.
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0) != 0;
 }
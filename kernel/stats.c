@@ -0,0 +1,104 @@
+//
+// The statistics device. Reading it returns a text
+// snapshot of kernel counters, so that user programs
+// (see user/stats.c) can observe lock contention and
+// the like. Each read takes a fresh snapshot and returns
+// it from the file's offset on, so readers with their own
+// open file don't disturb each other; read the whole
+// snapshot at once to see one consistent set of counters.
+//
+// Writing "<knob> <0 or 1>" to it sets a kernel knob, for
+// benchmarks that compare two ways of doing something:
+//   fastcopy   copies to and from user memory through the
+//              process's kernel page table (vm.c)
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 16384
+static struct {
+  struct sleeplock lock;
+  char buf[BUFSZ];   // the snapshot being read
+  int warned;        // have we said BUFSZ is too small?
+} stats;
+
+// Collect every subsystem's counters into buf.
+static int
+statsdump(char *buf, int sz)
+{
+  int n = 0;
+
+  n += lockstats(buf+n, sz-n);
+  n += sleeplockstats(buf+n, sz-n);
+  n += kmemstats(buf+n, sz-n);
+  n += vmstats(buf+n, sz-n);
+  n += schedstats(buf+n, sz-n);
+  n += cpustats(buf+n, sz-n);
+  n += timerstats(buf+n, sz-n);
+  n += execstats(buf+n, sz-n);
+  n += bcachestats(buf+n, sz-n);
+  n += logstats(buf+n, sz-n);
+  n += virtiostats(buf+n, sz-n);
+  n += pipestats(buf+n, sz-n);
+  n += ringstats(buf+n, sz-n);
+  return n;
+}
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  char cmd[32];
+  int m;
+
+  if(n <= 0 || n >= sizeof(cmd))
+    return -1;
+  if(either_copyin(cmd, user_src, src, n) == -1)
+    return -1;
+  cmd[n] = 0;
+  m = strlen("fastcopy ");
+  if(strncmp(cmd, "fastcopy ", m) == 0 && (cmd[m] == '0' || cmd[m] == '1')){
+    vmsetfastcopy(cmd[m] == '1');
+    return n;
+  }
+  return -1;
+}
+
+int
+statsread(int user_dst, uint64 dst, int n, uint off)
+{
+  int m = 0, sz;
+
+  acquiresleep(&stats.lock);
+  sz = statsdump(stats.buf, BUFSZ);
+  // snprintf() stops short of the end of its buffer, so
+  // the last sections may have been cut off.
+  if(sz >= BUFSZ - 32 && !stats.warned){
+    printf("statsread: counters truncated; raise BUFSZ\n");
+    stats.warned = 1;
+  }
+  if(off < sz){
+    m = sz - off;
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+off, m) == -1)
+      m = -1;
+  }
+  releasesleep(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initsleeplock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
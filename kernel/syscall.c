@@ -90,6 +90,11 @@ extern uint64 sys_exec(void);
 extern uint64 sys_exit(void);
 extern uint64 sys_fork(void);
 extern uint64 sys_fstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
 extern uint64 sys_getpid(void);
 extern uint64 sys_kill(void);
 extern uint64 sys_link(void);
@@ -127,6 +132,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fsync]   sys_fsync,
+[SYS_setpriority] sys_setpriority,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
 };
 
 void
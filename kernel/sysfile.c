@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "ring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -115,6 +116,39 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Return once every update made so far, including those
+// to fd's file, is on disk. System calls that modify the
+// file system return before their updates are committed.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_force();
+  return 0;
+}
+
+// Write n bytes at addr to the pipe fd, like write(), but
+// move whole pages to the pipe by reference instead of
+// copying them, where addr and the pipe's contents line up
+// on page boundaries. The pages become copy-on-write, so
+// the caller may go on to reuse them.
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(f->type != FD_PIPE || f->writable == 0)
+    return -1;
+  return pipesplice(f->pipe, p, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -283,17 +317,14 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for open() and RING_OPEN.
+// Returns a new file descriptor, or -1.
+static int
+openpath(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -322,6 +353,13 @@ sys_open(void)
     return -1;
   }
 
+  // a running program can't be written; see exec.c.
+  if((omode & (O_WRONLY|O_RDWR|O_TRUNC)) && ip->nexec > 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -351,6 +389,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -484,3 +533,162 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// ring statistics, updated atomically.
+static uint64 nringenter;  // ringenter() calls
+static uint64 nringop;     // entries performed
+static uint64 nringpoll;   // entries performed at a clock tick
+
+// Perform one submission entry, as the matching system
+// call would, and return its result.
+static int
+ringop(struct sqe *e)
+{
+  struct proc *p = myproc();
+  char path[MAXPATH];
+  struct file *f;
+
+  if(e->op == RING_NOP)
+    return 0;
+  if(e->op == RING_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->n);
+  }
+  if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  if(e->op == RING_READ)
+    return fileread(f, e->addr, e->n);
+  if(e->op == RING_WRITE)
+    return filewrite(f, e->addr, e->n);
+  if(e->op == RING_FSTAT)
+    return filestat(f, e->addr);
+  if(e->op == RING_CLOSE){
+    p->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// Can ringpoll() perform e? Not if it might wait for
+// as long as another process or the user pleases (pipes,
+// the console), or takes path lookups (open): a clock
+// tick must not park the process's user code behind it.
+static int
+ringpollable(struct sqe *e)
+{
+  struct proc *p = myproc();
+  struct file *f;
+
+  if(e->op == RING_NOP)
+    return 1;
+  if(e->op == RING_OPEN)
+    return 0;
+  if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+    return 1;  // fails at once
+  if(e->op == RING_READ || e->op == RING_WRITE)
+    return f->type == FD_INODE;
+  return 1;
+}
+
+// Perform up to max entries from p's submission ring, in
+// order, while there is room for their completions. If
+// poll is set, stop at the first entry that ringpollable()
+// refuses, leaving it for ringenter().
+// Returns the number performed, or -1 if the ring is
+// not readable and writable memory, or is corrupt.
+static int
+ringrun(struct proc *p, int max, int poll)
+{
+  struct ring *r = (struct ring*)p->ring;  // user address
+  uint hdr[4];  // sqhead, sqtail, cqhead, cqtail
+  struct sqe e;
+  struct cqe c;
+  int n = 0;
+
+  if(copyin(p->pagetable, (char*)hdr, (uint64)r, sizeof(hdr)) < 0)
+    return -1;
+  if(hdr[1] - hdr[0] > NSQE || hdr[3] - hdr[2] > NCQE)
+    return -1;
+  while(n < max && hdr[0] != hdr[1] && hdr[3] - hdr[2] < NCQE && !p->killed){
+    if(copyin(p->pagetable, (char*)&e, (uint64)&r->sq[hdr[0] % NSQE], sizeof(e)) < 0)
+      return -1;
+    if(poll && !ringpollable(&e))
+      break;
+    c.data = e.data;
+    c.res = ringop(&e);
+    c.pad = 0;
+    if(copyout(p->pagetable, (uint64)&r->cq[hdr[3] % NCQE], (char*)&c, sizeof(c)) < 0)
+      return -1;
+    hdr[0]++;
+    hdr[3]++;
+    n++;
+  }
+  if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&hdr[0], sizeof(uint)) < 0 ||
+     copyout(p->pagetable, (uint64)&r->cqtail, (char*)&hdr[3], sizeof(uint)) < 0)
+    return -1;
+  __sync_fetch_and_add(&nringop, n);
+  return n;
+}
+
+// Use the struct ring at addr for ringenter(), or stop
+// using one, if addr is 0. The ring is per address space:
+// fork() keeps it, and exec() drops it.
+uint64
+sys_ringsetup(void)
+{
+  struct proc *p = myproc();
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  if(addr != 0 &&
+     (addr % sizeof(uint64) != 0 || addr + sizeof(struct ring) > p->sz))
+    return -1;
+  p->ring = addr;
+  return 0;
+}
+
+// Perform up to n entries queued on the ring. Returns
+// the number performed, or -1.
+uint64
+sys_ringenter(void)
+{
+  struct proc *p = myproc();
+  int n;
+
+  if(argint(0, &n) < 0 || p->ring == 0)
+    return -1;
+  __sync_fetch_and_add(&nringenter, 1);
+  return ringrun(p, n, 0);
+}
+
+// Called by usertrap() at a clock tick, if p has a ring:
+// perform the queued entries if p asked for RING_POLL,
+// so that it need not trap to submit them. Only goes as
+// far as the first entry that could block for long.
+void
+ringpoll(struct proc *p)
+{
+  uint flags;
+  int n;
+
+  if(copyin(p->pagetable, (char*)&flags, (uint64)&((struct ring*)p->ring)->flags,
+            sizeof(flags)) < 0 || (flags & RING_POLL) == 0)
+    return;
+  if((n = ringrun(p, NSQE, 1)) > 0)
+    __sync_fetch_and_add(&nringpoll, n);
+}
+
+// Report ring statistics for the statistics device.
+int
+ringstats(char *buf, int sz)
+{
+  int n = 0;
+
+  n += snprintf(buf+n, sz-n, "--- ring\n");
+  n += snprintf(buf+n, sz-n, "enters %ld entries %ld polled %ld\n",
+                nringenter, nringop, nringpoll);
+  return n;
+}
@@ -56,21 +56,10 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(n);
 }
 
 uint64
@@ -95,3 +84,15 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// set the base scheduling priority level of a process;
+// 0 is the highest.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
@@ -0,0 +1,111 @@
+// Sleeping for a number of clock ticks.
+//
+// sleep() used to sleep on &ticks, so every clock tick woke
+// every sleeping process just to check its deadline. Now
+// each sleeper hangs a timer on a wheel of NSLOT slots, in
+// the slot of the tick it is due, and clockintr() looks
+// only at the timers in the current tick's slot, waking
+// those that are due. A timer more than NSLOT ticks away
+// stays in its slot for whole turns of the wheel.
+//
+// tickslock protects the wheel.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+
+#define NSLOT 64
+
+struct timer {
+  uint expire;         // ticks when due
+  int pending;         // still on the wheel?
+  struct timer *next;  // next in the slot
+};
+
+static struct timer *wheel[NSLOT];
+
+// statistics, protected by tickslock.
+static uint64 nadd;    // timers added
+static uint64 nfire;   // timers that expired
+
+// Take t off the wheel.
+static void
+timerdel(struct timer *t)
+{
+  struct timer **tp;
+
+  for(tp = &wheel[t->expire % NSLOT]; *tp; tp = &(*tp)->next){
+    if(*tp == t){
+      *tp = t->next;
+      break;
+    }
+  }
+  t->pending = 0;
+}
+
+// Sleep for n clock ticks.
+// Returns 0, or -1 if the process was killed.
+int
+timersleep(int n)
+{
+  struct timer t;
+  struct proc *p = myproc();
+
+  acquire(&tickslock);
+  if(n <= 0){
+    release(&tickslock);
+    return 0;
+  }
+  t.expire = ticks + n;
+  t.pending = 1;
+  t.next = wheel[t.expire % NSLOT];
+  wheel[t.expire % NSLOT] = &t;
+  nadd++;
+  while(t.pending){
+    if(p->killed){
+      timerdel(&t);
+      release(&tickslock);
+      return -1;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
+
+// Wake the sleepers whose timers are due now.
+// Called by clockintr() with tickslock held,
+// after advancing ticks.
+void
+timertick(void)
+{
+  struct timer **tp, *t;
+
+  for(tp = &wheel[ticks % NSLOT]; (t = *tp) != 0; ){
+    if((int)(t->expire - ticks) <= 0){
+      *tp = t->next;
+      t->pending = 0;
+      nfire++;
+      wakeup(t);
+    } else {
+      tp = &t->next;
+    }
+  }
+}
+
+// Report timer statistics for the statistics device.
+int
+timerstats(char *buf, int sz)
+{
+  int n = 0;
+
+  acquire(&tickslock);
+  n += snprintf(buf+n, sz-n, "--- timer\n");
+  n += snprintf(buf+n, sz-n, "ticks %d timers %ld expired %ld\n",
+                ticks, nadd, nfire);
+  release(&tickslock);
+  return n;
+}
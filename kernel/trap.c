@@ -9,8 +9,14 @@
 struct spinlock tickslock;
 uint ticks;
 
+// mapped read-only at UCLOCK in every process.
+struct uclock *uclock;
+
 extern char trampoline[], uservec[], userret[];
 
+// in ucopy.S.
+extern char ucopy[], ucopyend[], ucopyfault[];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -20,6 +26,10 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((uclock = (struct uclock*)kalloc()) == 0)
+    panic("trapinit");
+  memset(uclock, 0, PGSIZE);
+  uclock->freq = 10000000;  // the time CSR counts at 10 MHz in qemu.
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -67,6 +77,11 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause() == 15) == 0){
+    // page fault on a page of the program not read in yet,
+    // a lazily allocated heap page, or a store to a
+    // copy-on-write page.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,9 +91,20 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
-    yield();
+  // a clock tick also performs any entries queued on the
+  // process's ring, if it asked for that.
+  if(which_dev == 2 && p->ring != 0){
+    intr_on();
+    ringpoll(p);
+    if(p->killed)
+      exit(-1);
+  }
+
+  // give up the CPU if this is a timer interrupt and the
+  // process's quantum is up, or if a higher-priority
+  // process is waiting.
+  if(which_dev == 2 || which_dev == 3)
+    preempt(which_dev == 2);
 
   usertrapret();
 }
@@ -96,16 +122,12 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
-  // send syscalls, interrupts, and exceptions to trampoline.S
+  // send syscalls, interrupts, and exceptions to trampoline.S.
+  // allocproc() and scheduler() have already set up the
+  // trapframe values that uservec will need when the process
+  // next re-enters the kernel.
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
-  // set up trapframe values that uservec will need when
-  // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
-
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
@@ -119,7 +141,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(p->asid);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -143,34 +165,53 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopy && sepc < (uint64)ucopyend){
+    // page fault in copyin() or copyout()'s fast path:
+    // make ucopy() return -1, for the slow path to handle.
+    sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+  // give up the CPU if this is a timer interrupt and the
+  // process's quantum is up, or if a higher-priority
+  // process is waiting.
+  if((which_dev == 2 || which_dev == 3) &&
+     myproc() != 0 && myproc()->state == RUNNING)
+    preempt(which_dev == 2);
 
-  // the yield() may have caused some traps to occur,
+  // the preempt() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
+// Send an inter-processor interrupt to CPU id.
+void
+ipi(int id)
+{
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
+}
+
 void
 clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
+  uclock->ticks = ticks;
+  if(ticks % BOOSTTICKS == 0)
+    schedboost();
+  timertick();
   release(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if an ipi() from another CPU,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -201,17 +242,22 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or an IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    if(!clockpending()){
+      // only an IPI, which got the CPU out of wfi.
+      return 3;
+    }
+
+    if(cpuid() == 0){
+      clockintr();
+    }
+
     return 2;
   } else {
     return 0;
@@ -45,7 +45,11 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
+
+// most data blocks in one request; each takes a descriptor,
+// besides the header and status descriptors.
+#define NVEC 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -61,7 +61,9 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[NVEC];        // the request's blocks, in disk order
+    int nb;
+    void (*done)(struct buf*);  // called for each b when the request completes
     char status;
   } info[NUM];
 
@@ -70,6 +72,13 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  // statistics, protected by vdisk_lock.
+  int inflight;     // requests submitted but not completed
+  int maxinflight;
+  uint64 nreq;      // requests submitted
+  uint64 nblock;    // blocks transferred by those requests
+  uint64 depthsum;  // sum of inflight as each request is submitted
   
 } __attribute__ ((aligned (PGSIZE))) disk;
 
@@ -184,12 +193,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +208,29 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// start one request for the n blocks bufs[0..n-1], which
+// must be consecutive on the disk. caller holds vdisk_lock.
+static void
+submit1(struct buf **bufs, int n, int write, void (*done)(struct buf*))
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bufs[0]->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then descriptors for
+  // the data, then one for a 1-byte status result. the data
+  // descriptors of one request are read or written in order, so
+  // a run of consecutive blocks can share a request.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the n+2 descriptors.
+  int idx[NVEC+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -237,24 +247,38 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    struct virtq_desc *d = &disk.desc[idx[i+1]];
+    d->addr = (uint64) bufs[i]->data;
+    d->len = BSIZE;
+    if(write)
+      d->flags = 0; // device reads b->data
+    else
+      d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d->flags |= VRING_DESC_F_NEXT;
+    d->next = idx[i+2];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record struct bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    bufs[i]->disk = 1;
+    disk.info[idx[0]].b[i] = bufs[i];
+  }
+  disk.info[idx[0]].nb = n;
+  disk.info[idx[0]].done = done;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.inflight++;
+  if(disk.inflight > disk.maxinflight)
+    disk.maxinflight = disk.inflight;
+  disk.nreq++;
+  disk.nblock += n;
+  disk.depthsum += disk.inflight;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -267,21 +291,64 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// Start reading or writing bufs[0..n-1], without waiting for
+// the disk. Each run of buffers with consecutive block numbers
+// (up to NVEC of them) goes to the disk as a single request.
+// The caller must hold each buffer's lock, and a buffer stays
+// busy (b->disk == 1) until its request completes. Then, if
+// done is not 0, virtio_disk_intr() calls done(b) for it,
+// without holding vdisk_lock; otherwise the caller should use
+// virtio_disk_wait(b).
+// Sleeps only if too few descriptors are free.
+void
+virtio_disk_submitv(struct buf **bufs, int n, int write, void (*done)(struct buf*))
+{
+  int i, k;
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i += k){
+    for(k = 1; i+k < n && k < NVEC; k++)
+      if(bufs[i+k]->dev != bufs[i]->dev ||
+         bufs[i+k]->blockno != bufs[i]->blockno + k)
+        break;
+    submit1(bufs+i, k, write, done);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// Start reading or writing b; see virtio_disk_submitv().
+void
+virtio_disk_submit(struct buf *b, int write, void (*done)(struct buf*))
+{
+  virtio_disk_submitv(&b, 1, write, done);
+}
 
+// Wait for a request started by virtio_disk_submit()
+// without a done function to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write, 0);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
+  struct buf *b, *head = 0, *tail = 0;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -304,12 +371,51 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    for(int i = 0; i < disk.info[id].nb; i++){
+      b = disk.info[id].b[i];
+      if(disk.info[id].done){
+        // chain b, in order, through the buf itself.
+        b->done = disk.info[id].done;
+        b->donenext = 0;
+        if(tail)
+          tail->donenext = b;
+        else
+          head = b;
+        tail = b;
+      }
+      disk.info[id].b[i] = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+    disk.info[id].nb = 0;
+    disk.info[id].done = 0;
+    free_chain(id);
+    disk.inflight--;
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
+
+  // the done functions may take other locks,
+  // e.g. to release the buffer.
+  // b may be reused once done(b) returns.
+  while((b = head) != 0){
+    head = b->donenext;
+    b->done(b);
+  }
+}
+
+// Report disk queue statistics for the statistics device.
+int
+virtiostats(char *buf, int sz)
+{
+  int n = 0;
+
+  acquire(&disk.vdisk_lock);
+  n += snprintf(buf+n, sz-n, "--- virtio\n");
+  n += snprintf(buf+n, sz-n, "requests %ld blocks %ld depth sum %ld max in flight %d\n",
+                disk.nreq, disk.nblock, disk.depthsum, disk.maxinflight);
+  release(&disk.vdisk_lock);
+  return n;
 }
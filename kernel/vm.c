@@ -5,16 +5,37 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// number of ASIDs the harts implement; see asidalloc().
+int nasid;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// page fault statistics, updated atomically.
+static uint64 nlazyfault;  // heap pages allocated on first touch
+static uint64 ncowfault;   // copy-on-write pages copied
+
+// user copy statistics, updated atomically.
+static uint64 nfastcopy;   // copies through the process's kernel page table
+static uint64 nslowcopy;   // copies that walked the user page table
+
+// take the fast path at all? cleared through the statistics
+// device, to measure the slow path (see vmsetfastcopy()).
+static int fastcopy = 1;
+
+// ucopy.S
+extern int ucopy(void *dst, const void *src, uint64 n);
+extern int ucopystr(char *dst, const char *src, uint64 max);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -30,6 +51,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, to read the time and send IPIs.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -58,13 +82,30 @@ kvminit(void)
 
 // Switch h/w page table register to the kernel's page table,
 // and enable paging.
+// The kernel page table has ASID 0, and each process's page
+// tables have ASIDs of their own; see asidalloc(). Find out
+// how many there are by writing all ones to the ASID field.
 void
 kvminithart()
 {
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(SATP_ASIDMASK));
+  nasid = ((r_satp() >> 44) & SATP_ASIDMASK) + 1;
+  if(nasid < 3)
+    panic("kvminithart: too few ASIDs");
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Switch back to the kernel's page table, as scheduler()
+// does after running a process. The kernel page table never
+// changes after boot, so none of the TLB's translations
+// under ASID 0 are stale, and it need not be flushed.
+void
+kvmswitch(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -97,6 +138,134 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   return &pagetable[PX(0, va)];
 }
 
+// Each process has its own kernel page table, which the
+// kernel uses while running on the process's behalf. It is
+// the kernel page table, except that the level-1 page-table
+// page for the lowest 1GB is the process's own copy, in which
+// the level-1 PTEs of the process's page table are mirrored,
+// wherever the kernel maps no device. Since those PTEs point
+// to the process's level-0 page-table pages, the kernel sees
+// the process's memory as the process does, and copyin() and
+// copyout() can reach it directly, with sstatus.SUM set,
+// instead of walking the page table in software.
+//
+// Mirrored PTEs are copied on demand by kvmuser(), and
+// cleared by kvmreset() before the process's page table is
+// freed.
+
+// Make a kernel page table for a new process.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt, l1;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc()) == 0){
+    kfree(kpt);
+    return 0;
+  }
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  memmove(l1, (void*)PTE2PA(kernel_pagetable[0]), PGSIZE);
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// Stop mirroring any of a process's page table in its
+// kernel page table kpt, because it is about to be freed.
+// The caller must flush the TLB.
+void
+kvmreset(pagetable_t kpt)
+{
+  pagetable_t l1 = (pagetable_t)PTE2PA(kpt[0]);
+  pagetable_t kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+
+  memmove(l1, kl1, PGSIZE);
+}
+
+// Free a process's kernel page table. The rest of
+// the pages it refers to belong to others.
+void
+kvmfree(pagetable_t kpt)
+{
+  kfree((void*)PTE2PA(kpt[0]));
+  kfree((void*)kpt);
+}
+
+// Can the kernel reach [va, va+len) of the current process's
+// memory through the process's kernel page table? Mirrors the
+// level-1 PTEs that cover it, if need be. Every page must be
+// mapped for the user: the stack guard page, for one, is not,
+// but the kernel could still reach it. The pages may still be
+// read-only, or copy-on-write.
+static int
+kvmuser(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  pagetable_t l1, ul1, kl1, l0;
+  uint64 a, last;
+  int changed = 0;
+
+  if(p == 0 || pagetable != p->pagetable || p->kpagetable == 0)
+    return 0;
+  if(len == 0 || va + len < va || va + len > (1L << PXSHIFT(2)))
+    return 0;
+  if((pagetable[0] & PTE_V) == 0)
+    return 0;
+  l1 = (pagetable_t)PTE2PA(p->kpagetable[0]);
+  ul1 = (pagetable_t)PTE2PA(pagetable[0]);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+
+  last = va + len - 1;
+  for(a = PGROUNDDOWN(va); a <= last; a += PGSIZE){
+    if((ul1[PX(1, a)] & PTE_V) == 0 || (kl1[PX(1, a)] & PTE_V) != 0)
+      return 0;
+    l0 = (pagetable_t)PTE2PA(ul1[PX(1, a)]);
+    if((l0[PX(0, a)] & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      return 0;
+    if(l1[PX(1, a)] != ul1[PX(1, a)]){
+      l1[PX(1, a)] = ul1[PX(1, a)];
+      changed = 1;
+    }
+  }
+  // sfence.vma with an address only flushes leaf PTEs.
+  if(changed)
+    sfence_vma_asid(p->asid + 1);
+  return 1;
+}
+
+// most pages uvmflush() flushes one at a time,
+// rather than all of an address space.
+#define NFLUSHPAGE 16
+
+// Flush this CPU's TLB of translations for the npages user
+// pages from va on, whose PTEs changed, if pagetable is the
+// current process's: under its ASID, and under the ASID of the
+// process's kernel page table, which mirrors the same PTEs.
+// Other page tables are either not in use yet, or being freed
+// along with their ASIDs. Other CPUs' TLBs are flushed when
+// the process moves to them; see asidcheck() in proc.c.
+static void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  if(p == 0 || pagetable != p->pagetable || npages == 0)
+    return;
+  if(npages > NFLUSHPAGE){
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(p->asid + 1);
+    return;
+  }
+  va = PGROUNDDOWN(va);
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    sfence_vma_page(a, p->asid);
+    sfence_vma_page(a, p->asid + 1);
+  }
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -172,10 +341,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+    // heap pages that were never touched are not mapped;
+    // see growproc(). the heap can be huge and almost all
+    // untouched, so skip whole missing page-table pages.
+    if((pte = walk(pagetable, a, 0)) == 0){
+      a |= (1L << PXSHIFT(1)) - PGSIZE;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -184,6 +358,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  uvmflush(pagetable, va, npages);
 }
 
 // create an empty user page table.
@@ -293,8 +468,10 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but not the physical
+// memory: writable pages are shared copy-on-write,
+// marked read-only with PTE_COW in both page tables,
+// and copied by uvmcow() on the first store.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -303,30 +480,204 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    if((pte = walk(old, i, 0)) == 0){
+      // lazily allocated, never touched: skip the rest
+      // of the missing page-table page.
+      i |= (1L << PXSHIFT(1)) - PGSIZE;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    krefinc((void*)pa);
   }
+  // the parent's writable pages just became read-only.
+  uvmflush(old, 0, PGROUNDUP(sz) / PGSIZE);
   return 0;
 
  err:
+  uvmflush(old, 0, i / PGSIZE);
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
 
+// Give the page containing va a private, writable
+// copy, if it is shared copy-on-write. The last
+// sharer keeps the page itself.
+// Returns 0 on success, -1 if va is not a
+// copy-on-write page or memory is exhausted.
+static int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  uvmflush(pagetable, va, 1);  // copyin() may have reached the old page directly.
+  kfree((void*)pa);
+  __sync_fetch_and_add(&ncowfault, 1);
+  return 0;
+}
+
+// Allocate a zeroed page for va, which lies below p->sz
+// but was never touched: growproc() only moves p->sz,
+// and the pages are allocated here on first use.
+// Returns 0 on success, -1 if memory is exhausted.
+static int
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, PGROUNDDOWN(va), PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  __sync_fetch_and_add(&nlazyfault, 1);
+  return 0;
+}
+
+// Handle a page fault by process p at user address va.
+// A page that is not mapped yet is read in from the
+// program file if it is part of the program image, or
+// else is a lazily allocated heap page. A store to a
+// mapped page copies it if it is copy-on-write.
+// Returns 0 if the process can go on, -1 if not.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  int r;
+
+  if(va >= p->sz || va >= MAXUVA)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(va < p->execsz)
+      r = execfault(p, va);
+    else
+      r = uvmlazy(p->pagetable, va);
+    // the TLB may hold on to the invalid PTE.
+    if(r == 0)
+      uvmflush(p->pagetable, va, 1);
+    return r;
+  }
+  if(write)
+    return uvmcow(p->pagetable, va);
+  return -1;
+}
+
+// Return the physical address of user va for copyin()
+// and copyout(), first faulting the page in if va
+// belongs to the current process.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  pa = walkaddr(pagetable, va);
+  if(pa == 0 && p != 0 && p->pagetable == pagetable &&
+     uvmfault(p, va, 0) == 0)
+    pa = walkaddr(pagetable, va);
+  return pa;
+}
+
+// Share the user page at va for a zero-copy transfer: make
+// it copy-on-write, so that later writes to it by either side
+// are not seen by the other, and return its physical address
+// with a reference added for the caller.
+// Returns 0 if va is not a user page.
+uint64
+uvmshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if((pa = uvmaddr(pagetable, va)) == 0)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    uvmflush(pagetable, va, 1);
+  }
+  krefinc((void*)pa);
+  return pa;
+}
+
+// Replace the user page at va with page pa, as if pa's
+// contents had been copied there. The caller's reference
+// to pa passes to the page table. Since others may map pa
+// too, it is mapped copy-on-write.
+// Returns 0 on success, -1 if va is not a writable user page.
+int
+uvmreplace(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if((old = uvmaddr(pagetable, va)) == 0)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if((*pte & (PTE_W|PTE_COW)) == 0)
+    return -1;
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW;
+  uvmflush(pagetable, va, 1);
+  kfree((void*)old);
+  return 0;
+}
+
+// Report page fault counts for the statistics device.
+int
+vmstats(char *buf, int sz)
+{
+  int n = 0;
+
+  n += snprintf(buf+n, sz-n, "--- vm\n");
+  n += snprintf(buf+n, sz-n, "lazy faults %ld cow faults %ld\n",
+                nlazyfault, ncowfault);
+  n += snprintf(buf+n, sz-n, "fast copies %ld slow copies %ld\n",
+                nfastcopy, nslowcopy);
+  return n;
+}
+
+// Turn the fast path of copyin(), copyout() and
+// copyinstr() on or off.
+void
+vmsetfastcopy(int on)
+{
+  __atomic_store_n(&fastcopy, on, __ATOMIC_RELAXED);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -347,12 +698,26 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+
+  // a store to a copy-on-write page faults, and makes
+  // ucopy() fail; the slow path below copies the page.
+  if(fastcopy && kvmuser(pagetable, dstva, len) && ucopy((void*)dstva, src, len) == 0){
+    __sync_fetch_and_add(&nfastcopy, 1);
+    return 0;
+  }
+  __sync_fetch_and_add(&nslowcopy, 1);
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(uvmaddr(pagetable, va0) == 0)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if((*pte & PTE_COW) && uvmcow(pagetable, va0) != 0)
+      return -1;
+    if((*pte & PTE_W) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -373,9 +738,15 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(fastcopy && kvmuser(pagetable, srcva, len) && ucopy(dst, (void*)srcva, len) == 0){
+    __sync_fetch_and_add(&nfastcopy, 1);
+    return 0;
+  }
+  __sync_fetch_and_add(&nslowcopy, 1);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -400,9 +771,15 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(fastcopy && kvmuser(pagetable, srcva, max) && ucopystr(dst, (char*)srcva, max) == 0){
+    __sync_fetch_and_add(&nfastcopy, 1);
+    return 0;
+  }
+  __sync_fetch_and_add(&nslowcopy, 1);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+1;  // header and LOGSIZE blocks, or -l
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -77,8 +77,20 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 3 && strcmp(argv[1], "-l") == 0){
+    // the header block, and room for transactions.
+    nlog = atoi(argv[2]) + 1;
+    if(nlog - 1 < MAXOPBLOCKS || nlog - 1 > LOGMAXBLOCKS){
+      fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+              MAXOPBLOCKS, (int)LOGMAXBLOCKS);
+      exit(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
     exit(1);
   }
 
@@ -92,6 +104,7 @@ main(int argc, char *argv[])
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
+  assert(nblocks > 0);
 
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
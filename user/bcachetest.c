@@ -0,0 +1,179 @@
+//
+// Exercise the buffer cache from several processes at once
+// and report how often its bucket locks were contended.
+//
+
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NROUND 100
+
+char buf[BSIZE];
+
+// Create file name with nblock blocks, each holding
+// its own block number in every int.
+void
+createfile(char *name, int nblock)
+{
+  int fd;
+
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("createfile %s failed\n", name);
+    exit(1);
+  }
+  for(int i = 0; i < nblock; i++){
+    for(int j = 0; j < BSIZE/sizeof(int); j++)
+      ((int*)buf)[j] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// Read file name, checking the contents written by createfile().
+void
+readfile(char *name, int nblock)
+{
+  int fd;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("open %s failed\n", name);
+    exit(1);
+  }
+  for(int i = 0; i < nblock; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("read %s failed\n", name);
+      exit(1);
+    }
+    if(((int*)buf)[0] != i || ((int*)buf)[BSIZE/sizeof(int)-1] != i){
+      printf("%s: block %d has wrong contents\n", name, i);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// Start NCHILD processes that each read file names[i]
+// nround times, and wait for them.
+void
+readall(char *names[], int nblock, int nround)
+{
+  int pid;
+
+  for(int i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(int r = 0; r < nround; r++)
+        readfile(names[i], nblock);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
+// Each process reads its own small file, which stays
+// in the cache: lookups should hit and rarely contend.
+void
+test0(void)
+{
+  char *names[NCHILD] = { "bf0", "bf1", "bf2", "bf3" };
+  int nblock = 4, spin0, t0;
+
+  printf("start test0\n");
+  for(int i = 0; i < NCHILD; i++)
+    createfile(names[i], nblock);
+  spin0 = statvalue("--- bcache", "#spin ");
+  t0 = uptime();
+  readall(names, nblock, NROUND);
+  printf("test0 results: %d ticks, %d contended bcache spins\n",
+         uptime() - t0, statvalue("--- bcache", "#spin ") - spin0);
+  for(int i = 0; i < NCHILD; i++)
+    unlink(names[i]);
+  printf("test0: OK\n");
+}
+
+// The files together are bigger than the static buffers,
+// so the cache has to grow, or recycle buffers.
+void
+test1(void)
+{
+  char *names[NCHILD] = { "bg0", "bg1", "bg2", "bg3" };
+  int nblock = NBUF, miss0, steal0, grow0;
+
+  printf("start test1\n");
+  for(int i = 0; i < NCHILD; i++)
+    createfile(names[i], nblock);
+  miss0 = statvalue("--- bcache", "miss ");
+  steal0 = statvalue("--- bcache", "steal ");
+  grow0 = statvalue("--- bcache", "grow ");
+  readall(names, nblock, 5);
+  printf("test1 results: %d misses, %d steals, %d pages added\n",
+         statvalue("--- bcache", "miss ") - miss0, statvalue("--- bcache", "steal ") - steal0,
+         statvalue("--- bcache", "grow ") - grow0);
+  for(int i = 0; i < NCHILD; i++)
+    unlink(names[i]);
+  printf("test1: OK\n");
+}
+
+// Fill the cache, then have a child touch memory until it
+// is killed for lack of it, so that kalloc() has to take
+// pages back from the cache. The file system must keep
+// working afterwards.
+void
+test2(void)
+{
+  char *name = "bh0";
+  int nblock = 200, shrink0, pid, xstatus;
+  char *a;
+
+  printf("start test2\n");
+  createfile(name, nblock);
+  readfile(name, nblock);
+  shrink0 = statvalue("--- bcache", "shrink ");
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // sbrk() allocates lazily; each touch takes a page.
+    while((a = sbrk(PGSIZE)) != (char*)-1)
+      *a = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  printf("test2 results: %d pages taken back from the cache\n",
+         statvalue("--- bcache", "shrink ") - shrink0);
+  readfile(name, nblock);
+  unlink(name);
+  printf("test2: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test0();
+  test1();
+  test2();
+  exit(0);
+}
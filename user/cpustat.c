@@ -0,0 +1,82 @@
+//
+// Print how busy each CPU was over an interval, from the
+// idle and busy cycle counts in the "--- cpu" section of
+// the statistics device.
+//
+// usage: cpustat [ticks]
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define SZ 16384
+
+char statbuf[SZ];
+
+// atoi() for counts that may not fit in an int.
+uint64
+atou64(char *s)
+{
+  uint64 n = 0;
+
+  while(*s >= '0' && *s <= '9')
+    n = n*10 + *s++ - '0';
+  return n;
+}
+
+// Fill idle[] and busy[] from the "--- cpu" section.
+void
+sample(uint64 *idle, uint64 *busy)
+{
+  int n, id;
+  char *p;
+
+  n = statistics(statbuf, SZ-1);
+  statbuf[n] = 0;
+  for(p = statbuf; *p; p++)
+    if(memcmp(p, "--- cpu\n", 8) == 0)
+      break;
+  if(*p == 0)
+    return;
+  for(p += 8; *p && memcmp(p, "cpu ", 4) == 0; ){
+    id = atoi(p + 4);
+    while(*p && memcmp(p, "idle ", 5) != 0)
+      p++;
+    if(id >= 0 && id < NCPU)
+      idle[id] = atou64(p + 5);
+    while(*p && memcmp(p, "busy ", 5) != 0)
+      p++;
+    if(id >= 0 && id < NCPU)
+      busy[id] = atou64(p + 5);
+    while(*p && *p++ != '\n')
+      ;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 idle0[NCPU], busy0[NCPU], idle1[NCPU], busy1[NCPU];
+  uint64 idle, busy;
+  int n = 10;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  memset(idle0, 0, sizeof(idle0));
+  memset(busy0, 0, sizeof(busy0));
+  memset(idle1, 0, sizeof(idle1));
+  memset(busy1, 0, sizeof(busy1));
+  sample(idle0, busy0);
+  sleep(n);
+  sample(idle1, busy1);
+
+  for(int i = 0; i < NCPU; i++){
+    idle = idle1[i] - idle0[i];
+    busy = busy1[i] - busy0[i];
+    if(idle + busy == 0)
+      continue;
+    printf("cpu %d: %d%% busy\n", i, (int)(busy * 100 / (idle + busy)));
+  }
+  exit(0);
+}
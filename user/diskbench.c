@@ -0,0 +1,95 @@
+//
+// Measure file write throughput with 1, 2, 4 and 8
+// processes writing at once, and report how many blocks
+// each disk request carried and how many requests the
+// virtio driver had in flight on average.
+//
+
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define MAXPROC 8
+#define NBLOCK 64     // blocks each process writes per round
+#define NROUND 4
+
+char buf[4*BSIZE];
+
+// Write, then remove, a file of NBLOCK blocks NROUND times.
+void
+writer(int id)
+{
+  char name[] = "dbX";
+  int fd;
+
+  name[2] = '0' + id;
+  memset(buf, id, sizeof(buf));
+  for(int r = 0; r < NROUND; r++){
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("diskbench: open %s failed\n", name);
+      exit(1);
+    }
+    for(int i = 0; i < NBLOCK; i += sizeof(buf)/BSIZE){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("diskbench: write %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink(name);
+  }
+  exit(0);
+}
+
+void
+run(int nproc)
+{
+  int pid, t, req0, blk0, depth0, req, blk, depth, xstatus;
+
+  req0 = statvalue("--- virtio", "requests ");
+  blk0 = statvalue("--- virtio", "blocks ");
+  depth0 = statvalue("--- virtio", "depth sum ");
+  t = uptime();
+  for(int i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("diskbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      writer(i);
+  }
+  for(int i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  t = uptime() - t;
+  req = statvalue("--- virtio", "requests ") - req0;
+  blk = statvalue("--- virtio", "blocks ") - blk0;
+  depth = statvalue("--- virtio", "depth sum ") - depth0;
+
+  printf("%d procs: %d blocks in %d ticks", nproc,
+         nproc * NBLOCK * NROUND, t);
+  if(t > 0)
+    printf(" (%d blocks/tick)", nproc * NBLOCK * NROUND / t);
+  printf(", %d disk requests", req);
+  if(req > 0)
+    printf(", %d.%d blocks each, average depth %d.%d",
+           blk / req, (blk * 10 / req) % 10,
+           depth / req, (depth * 10 / req) % 10);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  for(int nproc = 1; nproc <= MAXPROC; nproc *= 2)
+    run(nproc);
+  printf("max in flight %d\n", statvalue("--- virtio", "max in flight "));
+  exit(0);
+}
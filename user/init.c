@@ -23,6 +23,10 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  struct stat st;
+  if(stat("statistics", &st) < 0)
+    mknod("statistics", STATS, 0);
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
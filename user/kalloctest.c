@@ -0,0 +1,118 @@
+//
+// Stress kalloc()/kfree() from several processes at once
+// and print the allocator's per-CPU statistics, to show
+// how often the kmem locks were contended and how often
+// CPUs had to steal pages from each other.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define N 20000
+#define SZ 8192
+
+char buf[SZ];
+
+// Return the total number of contended spins on the
+// kmem locks, summed from the "--- kmem" section of
+// the statistics device.
+int
+kmemspins(void)
+{
+  int n, spins = 0;
+  char *p, *end;
+
+  n = statistics(buf, SZ-1);
+  buf[n] = 0;
+  for(p = buf; *p; p++)
+    if(memcmp(p, "--- kmem", 8) == 0)
+      break;
+  if(*p == 0)
+    return 0;
+  p += 8;
+  for(end = p; *end; end++)
+    if(memcmp(end, "---", 3) == 0)
+      break;
+  for(; p < end; p++)
+    if(memcmp(p, "#spin ", 6) == 0)
+      spins += atoi(p + 6);
+  return spins;
+}
+
+void
+test1(void)
+{
+  int pid, spins0, spins1, t0;
+
+  printf("start test1\n");
+  spins0 = kmemspins();
+  t0 = uptime();
+  for(int i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(int j = 0; j < N; j++){
+        char *a = sbrk(PGSIZE);
+        if(a == (char*)-1){
+          printf("sbrk failed\n");
+          exit(1);
+        }
+        *(int *)(a+4) = 1;
+        if(sbrk(-PGSIZE) == (char*)-1){
+          printf("sbrk(-) failed\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+
+  for(int i = 0; i < NCHILD; i++)
+    wait(0);
+  spins1 = kmemspins();
+  printf("test1 results: %d ticks, %d contended kmem spins\n",
+         uptime() - t0, spins1 - spins0);
+  printf("test1 done\n");
+}
+
+// Allocate nearly all of memory in one process, so that
+// its CPU must steal pages from the other CPUs' lists.
+void
+test2(void)
+{
+  int n = 0;
+
+  printf("start test2\n");
+  for(;;){
+    char *a = sbrk(PGSIZE);
+    if(a == (char*)-1)
+      break;
+    *(int *)(a+4) = 1;
+    n++;
+    if(n >= 16*1024)  // 64MB is plenty to drain other lists.
+      break;
+  }
+  sbrk(-n*PGSIZE);
+  printf("test2: allocated and freed %d pages\n", n);
+  printf("test2 done\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  test1();
+  test2();
+  n = statistics(buf, SZ-1);
+  buf[n] = 0;
+  printf("%s", buf);
+  exit(0);
+}
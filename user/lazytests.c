@@ -0,0 +1,235 @@
+//
+// tests for lazy (demand-zero) heap allocation.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+#define REGION_SZ (1024 * 1024 * 1024)
+
+// Return the number of lazily satisfied page faults so far,
+// from the "--- vm" section of the statistics device.
+int
+lazyfaults(void)
+{
+  return statvalue("--- vm", "lazy faults ");
+}
+
+// sbrk a huge region, but only touch every 64th page;
+// the untouched pages must cost nothing.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+  int f0, f1;
+
+  f0 = lazyfaults();
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char **)i != i){
+      printf("failed to read value from memory\n");
+      exit(1);
+    }
+  }
+
+  f1 = lazyfaults();
+  if(f0 >= 0 && f1 - f0 < REGION_SZ / (64 * PGSIZE)){
+    printf("only %d lazy faults\n", f1 - f0);
+    exit(1);
+  }
+
+  exit(0);
+}
+
+// touch pages, give the memory back, and check that
+// accesses to it are no longer allowed.
+void
+sparse_memory_unmap(char *s)
+{
+  int pid;
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE){
+    pid = fork();
+    if(pid < 0){
+      printf("error forking\n");
+      exit(1);
+    } else if(pid == 0){
+      sbrk(-1L * REGION_SZ);
+      *(char **)i = i;
+      exit(0);
+    } else {
+      int status;
+      wait(&status);
+      if(status == 0){
+        printf("memory not unmapped\n");
+        exit(1);
+      }
+    }
+  }
+
+  exit(0);
+}
+
+// a process that touches more memory than the machine
+// has must be killed, not hang or crash the kernel.
+void
+oom(char *s)
+{
+  void *m1, *m2;
+  int pid;
+
+  if((pid = fork()) == 0){
+    m1 = 0;
+    while((m2 = malloc(4096*4096)) != 0){
+      for(char *q = m2; q < (char*)m2 + 4096*4096; q += PGSIZE)
+        *q = 1;
+      *(char**)m2 = m1;
+      m1 = m2;
+    }
+    exit(0);
+  } else {
+    int xstatus;
+    wait(&xstatus);
+    exit(xstatus == 0);
+  }
+}
+
+// system calls must accept pointers into heap pages
+// that have not been touched yet.
+void
+lazy_copy(char *s)
+{
+  char *p, *q;
+  int fd;
+
+  p = sbrk(4 * PGSIZE);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+
+  // copyout() into an untouched page.
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("open README failed\n");
+    exit(1);
+  }
+  if(read(fd, p + PGSIZE + 100, 512) != 512){
+    printf("read into lazy page failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // copyin() from an untouched page, which must read as zero.
+  q = p + 3 * PGSIZE;
+  fd = open("lazy.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("open lazy.tmp failed\n");
+    exit(1);
+  }
+  if(write(fd, q, 100) != 100){
+    printf("write from lazy page failed\n");
+    exit(1);
+  }
+  close(fd);
+  fd = open("lazy.tmp", O_RDONLY);
+  if(read(fd, p, 100) != 100){
+    printf("read lazy.tmp failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("lazy.tmp");
+  for(int i = 0; i < 100; i++){
+    if(p[i] != 0){
+      printf("untouched page was not zero\n");
+      exit(1);
+    }
+  }
+
+  exit(0);
+}
+
+// run each test in its own process. returns 1 if it passed.
+int
+run(void f(char *), char *s)
+{
+  int pid;
+  int xstatus;
+
+  printf("running test %s\n", s);
+  if((pid = fork()) < 0){
+    printf("runtest: fork error\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("test %s: FAILED\n", s);
+    else
+      printf("test %s: OK\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *n = 0;
+  if(argc > 1){
+    n = argv[1];
+  }
+
+  struct test {
+    void (*f)(char *);
+    char *s;
+  } tests[] = {
+    { sparse_memory, "lazy alloc"},
+    { sparse_memory_unmap, "lazy unmap"},
+    { lazy_copy, "lazy copyin/copyout"},
+    { oom, "out of memory"},
+    { 0, 0},
+  };
+
+  printf("lazytests starting\n");
+
+  int fail = 0;
+  for(struct test *t = tests; t->s != 0; t++){
+    if((n == 0) || strcmp(t->s, n) == 0){
+      if(!run(t->f, t->s))
+        fail = 1;
+    }
+  }
+  if(!fail)
+    printf("ALL TESTS PASSED\n");
+  else
+    printf("SOME TESTS FAILED\n");
+  exit(fail);
+}
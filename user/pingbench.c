@@ -0,0 +1,105 @@
+//
+// Measure the round-trip latency of passing a byte back and
+// forth between two processes over a pair of pipes, with and
+// without many other processes asleep, and report how many
+// sleeping processes each wakeup() had to look at.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NROUND 5000
+#define NIDLE 40
+
+// Start n processes that sleep reading a pipe, until its
+// write end, which is returned, is closed.
+int
+idlers(int n)
+{
+  int fds[2];
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("pingbench: pipe failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("pingbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  return fds[1];
+}
+
+void
+run(int nidle)
+{
+  int ping[2], pong[2], fd, pid, t, w0, n0, w, n;
+  char c = 0;
+
+  fd = idlers(nidle);
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("pingbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("pingbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < NROUND; i++){
+      if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1){
+        printf("pingbench: child i/o failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  w0 = statvalue("--- sched", "wakeups ");
+  n0 = statvalue("--- sched", "waiters ");
+  t = uptime();
+  for(int i = 0; i < NROUND; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf("pingbench: parent i/o failed\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t;
+  w = statvalue("--- sched", "wakeups ") - w0;
+  n = statvalue("--- sched", "waiters ") - n0;
+  wait(0);
+  close(ping[0]); close(ping[1]);
+  close(pong[0]); close(pong[1]);
+
+  printf("%d sleeping: %d round trips in %d ticks", nidle, NROUND, t);
+  if(t > 0)
+    printf(" (%d per tick)", NROUND / t);
+  if(w > 0)
+    printf(", %d wakeups looked at %d.%d processes each",
+           w, n / w, (n * 10 / w) % 10);
+  printf("\n");
+
+  // let the idlers go.
+  close(fd);
+  for(int i = 0; i < nidle; i++)
+    wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  run(0);
+  run(NIDLE);
+  exit(0);
+}
@@ -0,0 +1,85 @@
+//
+// Measure pipe throughput between two processes for
+// several write sizes, and report how many wakeup()
+// calls each run cost. Then do the same with vmsplice(),
+// and report how many pages moved by reference.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define TOTAL (1024*1024)  // bytes sent per run
+#define MAXCHUNK 16384
+
+char *buf;  // page-aligned, MAXCHUNK bytes
+
+void
+run(int chunk, int splice)
+{
+  int fds[2], pid, n, got, t, w, s;
+
+  if(pipe(fds) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  w = statvalue("--- sched", "wakeups ");
+  s = statvalue("--- pipe", "remapped ");
+  t = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < TOTAL; i += chunk){
+      n = splice ? vmsplice(fds[1], buf, chunk) : write(fds[1], buf, chunk);
+      if(n != chunk){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, chunk)) > 0)
+    got += n;
+  close(fds[0]);
+  wait(0);
+  t = uptime() - t;
+  w = statvalue("--- sched", "wakeups ") - w;
+  s = statvalue("--- pipe", "remapped ") - s;
+
+  if(got != TOTAL){
+    printf("pipebench: got %d bytes, expected %d\n", got, TOTAL);
+    exit(1);
+  }
+  printf("%d-byte %s: %d KB in %d ticks", chunk,
+         splice ? "vmsplices" : "writes", TOTAL/1024, t);
+  if(t > 0)
+    printf(" (%d KB/tick)", TOTAL/1024/t);
+  printf(", %d wakeups", w);
+  if(splice)
+    printf(", %d pages remapped", s);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p = sbrk(MAXCHUNK + PGSIZE);
+
+  if(p == (char*)-1){
+    printf("pipebench: sbrk failed\n");
+    exit(1);
+  }
+  buf = (char*)PGROUNDUP((uint64)p);
+  for(int chunk = 64; chunk <= MAXCHUNK; chunk *= 4)
+    run(chunk, 0);
+  for(int chunk = PGSIZE; chunk <= MAXCHUNK; chunk *= 4)
+    run(chunk, 1);
+  exit(0);
+}
@@ -0,0 +1,248 @@
+//
+// Compare reading a file a byte at a time with read() to
+// queueing the same one-byte reads on a submission ring and
+// performing a batch of them with each ringenter(). Also
+// checks open, fstat and close through the ring, and that
+// a RING_POLL ring is drained without any ringenter(), up
+// to the first entry that could block.
+//
+
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/ring.h"
+#include "user/user.h"
+
+#define FILESZ 4096
+
+struct ring ring;
+char data[FILESZ];
+char buf[FILESZ];
+
+// Queue an entry; the ring must have room.
+void
+submit(int op, int fd, void *addr, int n, uint64 id)
+{
+  struct sqe *e = &ring.sq[ring.sqtail % NSQE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = id;
+  __sync_synchronize();
+  ring.sqtail++;
+}
+
+// Take the next completion, which must be there.
+struct cqe *
+complete(void)
+{
+  struct cqe *c;
+
+  if(ring.cqhead == __atomic_load_n(&ring.cqtail, __ATOMIC_ACQUIRE)){
+    printf("ringbench: missing completion\n");
+    exit(1);
+  }
+  c = &ring.cq[ring.cqhead % NCQE];
+  ring.cqhead++;
+  return c;
+}
+
+int
+openfile(void)
+{
+  int fd;
+
+  if((fd = open("rbfile", O_RDONLY)) < 0){
+    printf("ringbench: open rbfile failed\n");
+    exit(1);
+  }
+  return fd;
+}
+
+void
+readbench(void)
+{
+  uint64 t0, t1;
+  struct cqe *c;
+  int fd, n;
+
+  // one read() per byte.
+  fd = openfile();
+  t0 = r_time();
+  for(int i = 0; i < FILESZ; i++){
+    if(read(fd, &buf[i], 1) != 1){
+      printf("ringbench: read failed\n");
+      exit(1);
+    }
+  }
+  t0 = r_time() - t0;
+  close(fd);
+  if(memcmp(buf, data, FILESZ) != 0){
+    printf("ringbench: read() got wrong data\n");
+    exit(1);
+  }
+
+  // NSQE one-byte reads per ringenter().
+  memset(buf, 0, FILESZ);
+  fd = openfile();
+  t1 = r_time();
+  for(int i = 0; i < FILESZ; i += NSQE){
+    for(int j = i; j < i + NSQE; j++)
+      submit(RING_READ, fd, &buf[j], 1, j);
+    if((n = ringenter(NSQE)) != NSQE){
+      printf("ringbench: ringenter returned %d\n", n);
+      exit(1);
+    }
+    for(int j = i; j < i + NSQE; j++){
+      c = complete();
+      if(c->res != 1 || c->data != j){
+        printf("ringbench: read %d: res %d data %d\n", j, c->res, (int)c->data);
+        exit(1);
+      }
+    }
+  }
+  t1 = r_time() - t1;
+  close(fd);
+  if(memcmp(buf, data, FILESZ) != 0){
+    printf("ringbench: ring reads got wrong data\n");
+    exit(1);
+  }
+
+  // the time CSR counts at 10 MHz in qemu.
+  printf("%d one-byte reads: read() %d us, ring %d us (%d per ringenter)\n",
+         FILESZ, (int)(t0 / 10), (int)(t1 / 10), NSQE);
+}
+
+// open, fstat and close the file through the ring.
+void
+filetest(void)
+{
+  struct stat st;
+  struct cqe *c;
+  int fd;
+
+  submit(RING_OPEN, 0, "rbfile", O_RDONLY, 0);
+  if(ringenter(1) != 1 || (fd = complete()->res) < 0){
+    printf("ringbench: RING_OPEN failed\n");
+    exit(1);
+  }
+  submit(RING_FSTAT, fd, &st, 0, 1);
+  submit(RING_CLOSE, fd, 0, 0, 2);
+  submit(RING_CLOSE, fd, 0, 0, 3);
+  if(ringenter(NSQE) != 3){
+    printf("ringbench: ringenter failed\n");
+    exit(1);
+  }
+  c = complete();
+  if(c->data != 1 || c->res != 0 || st.size != FILESZ){
+    printf("ringbench: RING_FSTAT failed\n");
+    exit(1);
+  }
+  c = complete();
+  if(c->data != 2 || c->res != 0){
+    printf("ringbench: RING_CLOSE failed\n");
+    exit(1);
+  }
+  c = complete();
+  if(c->data != 3 || c->res != -1){
+    printf("ringbench: second RING_CLOSE should fail\n");
+    exit(1);
+  }
+  printf("open/fstat/close: OK\n");
+}
+
+// queue entries on a RING_POLL ring and spin until the
+// kernel performs them at a clock tick. A pipe read might
+// block, so the kernel must leave it, and what follows it,
+// for ringenter().
+void
+polltest(void)
+{
+  int fds[2], t;
+  char c = 'p';
+  struct cqe *e;
+
+  ring.flags = RING_POLL;
+  t = uptime();
+  for(int i = 0; i < NSQE; i++)
+    submit(RING_NOP, 0, 0, 0, i);
+  while(__atomic_load_n(&ring.cqtail, __ATOMIC_ACQUIRE) != ring.sqtail){
+    if(uptime() - t > 10){
+      printf("ringbench: RING_POLL ring not drained\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NSQE; i++)
+    if(complete()->data != i){
+      printf("ringbench: RING_POLL completions out of order\n");
+      exit(1);
+    }
+
+  if(pipe(fds) < 0 || write(fds[1], &c, 1) != 1){
+    printf("ringbench: pipe failed\n");
+    exit(1);
+  }
+  c = 0;
+  submit(RING_NOP, 0, 0, 0, 0);
+  submit(RING_READ, fds[0], &c, 1, 1);
+  submit(RING_NOP, 0, 0, 0, 2);
+  t = uptime();
+  while(__atomic_load_n(&ring.cqtail, __ATOMIC_ACQUIRE) == ring.cqhead){
+    if(uptime() - t > 10){
+      printf("ringbench: RING_POLL ring not polled\n");
+      exit(1);
+    }
+  }
+  // a few more ticks in user code, in which the read
+  // must stay queued.
+  t = uuptime();
+  while(uuptime() - t < 3)
+    ;
+  if(ring.cqtail != ring.cqhead + 1 || complete()->data != 0){
+    printf("ringbench: RING_POLL performed a pipe read\n");
+    exit(1);
+  }
+  if(ringenter(NSQE) != 2){
+    printf("ringbench: ringenter failed\n");
+    exit(1);
+  }
+  e = complete();
+  if(e->data != 1 || e->res != 1 || c != 'p' || complete()->data != 2){
+    printf("ringbench: pipe read through the ring failed\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  ring.flags = 0;
+  printf("poll: %d entries performed without ringenter, pipe read left: OK\n", NSQE);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd;
+
+  for(int i = 0; i < FILESZ; i++)
+    data[i] = 'a' + i % 26;
+  fd = open("rbfile", O_CREATE | O_WRONLY | O_TRUNC);
+  if(fd < 0 || write(fd, data, FILESZ) != FILESZ){
+    printf("ringbench: create rbfile failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  if(ringsetup(&ring) < 0){
+    printf("ringbench: ringsetup failed\n");
+    exit(1);
+  }
+  readbench();
+  filetest();
+  polltest();
+  ringsetup(0);
+  unlink("rbfile");
+  exit(0);
+}
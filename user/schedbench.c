@@ -0,0 +1,153 @@
+//
+// Measure how long an interactive process waits to run
+// after it is woken, while 0, 2, 4 and 8 CPU-bound
+// processes compete for the CPUs. Then check that a boost
+// returns each process to its own base level: CPU-bound
+// processes at base level 2 must not get more of the CPUs
+// than ones at base level 1.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXHOG 8
+#define NROUND 50
+
+int hogs[MAXHOG];
+
+void
+run(int nhog)
+{
+  int fds[2], pid;
+  uint64 t, lat, sum = 0, max = 0;
+
+  for(int i = 0; i < nhog; i++){
+    hogs[i] = fork();
+    if(hogs[i] < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(hogs[i] == 0)
+      for(;;)
+        ;
+  }
+  // let the hogs use up their quanta.
+  sleep(2*NPRIO);
+
+  if(pipe(fds) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // wake the parent once a tick, sending the time.
+    close(fds[0]);
+    for(int i = 0; i < NROUND; i++){
+      sleep(1);
+      t = r_time();
+      if(write(fds[1], &t, sizeof(t)) != sizeof(t)){
+        printf("schedbench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(int i = 0; i < NROUND; i++){
+    if(read(fds[0], &t, sizeof(t)) != sizeof(t)){
+      printf("schedbench: read failed\n");
+      exit(1);
+    }
+    lat = r_time() - t;
+    sum += lat;
+    if(lat > max)
+      max = lat;
+  }
+  close(fds[0]);
+  wait(0);
+
+  for(int i = 0; i < nhog; i++){
+    kill(hogs[i]);
+    wait(0);
+  }
+
+  // the time CSR counts at 10 MHz in qemu.
+  printf("%d hogs: wakeup latency average %d us, max %d us\n",
+         nhog, (int)(sum / NROUND / 10), (int)(max / 10));
+}
+
+// Run MAXHOG/2 hogs at base level 1 and as many at base
+// level 2 for a couple of boost periods, each counting how
+// many times it got round its loop, and compare the totals.
+void
+basetest(void)
+{
+  int fds[NPRIO][2], end, prio;
+  uint64 n, sum[NPRIO];
+
+  for(prio = 1; prio < NPRIO; prio++){
+    sum[prio] = 0;
+    if(pipe(fds[prio]) < 0){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+  }
+  end = uptime() + 2*BOOSTTICKS;
+  for(int i = 0; i < MAXHOG; i++){
+    prio = 1 + i % 2;
+    hogs[i] = fork();
+    if(hogs[i] < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(hogs[i] == 0){
+      if(setpriority(getpid(), prio) < 0){
+        printf("schedbench: setpriority failed\n");
+        exit(1);
+      }
+      // uuptime() reads the clock page, with no system call.
+      for(n = 0; uuptime() < end; n++)
+        ;
+      if(write(fds[prio][1], &n, sizeof(n)) != sizeof(n)){
+        printf("schedbench: write failed\n");
+        exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(int i = 0; i < MAXHOG; i++){
+    prio = 1 + i % 2;
+    if(read(fds[prio][0], &n, sizeof(n)) != sizeof(n)){
+      printf("schedbench: read failed\n");
+      exit(1);
+    }
+    sum[prio] += n;
+    wait(0);
+  }
+  for(prio = 1; prio < NPRIO; prio++){
+    close(fds[prio][0]);
+    close(fds[prio][1]);
+  }
+
+  printf("base level 1: %dK loops, base level 2: %dK loops\n",
+         (int)(sum[1] / 1000), (int)(sum[2] / 1000));
+  if(sum[2] > sum[1]){
+    printf("schedbench: base level 2 ran more than base level 1\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  for(int nhog = 0; nhog <= MAXHOG; nhog = nhog ? nhog*2 : 2)
+    run(nhog);
+  basetest();
+  exit(0);
+}
@@ -0,0 +1,56 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define STATSZ 16384  // as big as the kernel's snapshot
+
+// Read a snapshot of the kernel's statistics device
+// into buf. Returns the number of bytes read.
+int
+statistics(void *buf, int sz)
+{
+  int fd, i, n;
+
+  fd = open("statistics", O_RDONLY);
+  if(fd < 0) {
+    fprintf(2, "stats: open failed\n");
+    exit(1);
+  }
+  for (i = 0; i < sz; ) {
+    if ((n = read(fd, buf+i, sz-i)) <= 0) {
+      break;
+    }
+    i += n;
+  }
+  close(fd);
+  return i;
+}
+
+// Return the value following key in the given section of
+// the statistics device (e.g. "--- vm", "fast copies "),
+// or 0 if there is no such line.
+int
+statvalue(char *section, char *key)
+{
+  int n, r = 0, klen = strlen(key), slen = strlen(section);
+  char *buf, *p;
+
+  if((buf = malloc(STATSZ)) == 0){
+    fprintf(2, "stats: out of memory\n");
+    exit(1);
+  }
+  n = statistics(buf, STATSZ-1);
+  buf[n] = 0;
+  for(p = buf; *p; p++)
+    if(memcmp(p, section, slen) == 0)
+      break;
+  for(; *p; p++){
+    if(memcmp(p, key, klen) == 0){
+      r = atoi(p + klen);
+      break;
+    }
+  }
+  free(buf);
+  return r;
+}
@@ -0,0 +1,154 @@
+//
+// Measure the cost of a system call that does nothing but
+// enter and leave the kernel, and how fast read() and write()
+// move data between user memory and the kernel: reads of a
+// file that stays in the buffer cache, and writes and reads
+// through a pipe. Runs the copy tests with the kernel's
+// fast path for user copies on, then off (see copyin() in
+// vm.c), and reports the throughput of each, and how many
+// copies took the fast path.
+//
+// usage: sysbench [chunk]
+//
+
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define FILESZ (16*1024)
+#define NBYTES (4*1024*1024)  // bytes each test moves
+#define MAXCHUNK 4096
+#define NCALL 100000
+
+char buf[MAXCHUNK];
+
+// Turn the kernel's fast path for user copies on or off,
+// through the statistics device.
+void
+setfastcopy(int on)
+{
+  int fd;
+
+  fd = open("statistics", O_WRONLY);
+  if(fd < 0 || write(fd, on ? "fastcopy 1" : "fastcopy 0", 10) != 10){
+    printf("sysbench: can't set fastcopy\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+// Print the rate at which nbytes moved in ns nanoseconds.
+void
+report(char *what, int chunk, uint64 nbytes, uint64 ns, int fast, int slow)
+{
+  if(ns == 0)
+    ns = 1;
+  printf("%s, %d-byte chunks: %d KB/s, %d fast and %d slow copies\n",
+         what, chunk, (int)(nbytes * 1000000000 / ns / 1024), fast, slow);
+}
+
+// getpid() as a null system call.
+void
+nullcall(void)
+{
+  uint64 t;
+
+  t = uclockns();
+  for(int i = 0; i < NCALL; i++)
+    getpid();
+  t = uclockns() - t;
+  printf("null system call: %d ns\n", (int)(t / NCALL));
+}
+
+void
+readfile(int chunk)
+{
+  uint64 n = 0, t;
+  int fd, fast, slow;
+
+  fd = open("sbfile", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("sysbench: create sbfile failed\n");
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(int i = 0; i < FILESZ; i += sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("sysbench: write sbfile failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fast = statvalue("--- vm", "fast copies ");
+  slow = statvalue("--- vm", "slow copies ");
+  t = uclockns();
+  while(n < NBYTES){
+    if((fd = open("sbfile", O_RDONLY)) < 0){
+      printf("sysbench: open sbfile failed\n");
+      exit(1);
+    }
+    for(int i = 0; i < FILESZ; i += chunk){
+      if(read(fd, buf, chunk) != chunk){
+        printf("sysbench: read sbfile failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+    n += FILESZ;
+  }
+  t = uclockns() - t;
+  report("file read", chunk, n, t, statvalue("--- vm", "fast copies ") - fast,
+         statvalue("--- vm", "slow copies ") - slow);
+  unlink("sbfile");
+}
+
+void
+pipewr(int chunk)
+{
+  uint64 n, t;
+  int fds[2], fast, slow;
+
+  if(pipe(fds) < 0){
+    printf("sysbench: pipe failed\n");
+    exit(1);
+  }
+  fast = statvalue("--- vm", "fast copies ");
+  slow = statvalue("--- vm", "slow copies ");
+  t = uclockns();
+  for(n = 0; n < NBYTES; n += chunk){
+    if(write(fds[1], buf, chunk) != chunk || read(fds[0], buf, chunk) != chunk){
+      printf("sysbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  t = uclockns() - t;
+  report("pipe write+read", chunk, n, t, statvalue("--- vm", "fast copies ") - fast,
+         statvalue("--- vm", "slow copies ") - slow);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int chunk = MAXCHUNK;
+
+  if(argc > 1)
+    chunk = atoi(argv[1]);
+  if(chunk <= 0 || chunk > MAXCHUNK || FILESZ % chunk != 0){
+    printf("sysbench: chunk must divide %d and be at most %d\n",
+           FILESZ, MAXCHUNK);
+    exit(1);
+  }
+  nullcall();
+  for(int on = 1; on >= 0; on--){
+    printf("fast path %s:\n", on ? "on" : "off");
+    setfastcopy(on);
+    readfile(chunk);
+    pipewr(chunk);
+  }
+  setfastcopy(1);
+  exit(0);
+}
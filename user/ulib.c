@@ -1,6 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +136,37 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// The kernel maps pages at USYSCALL and UCLOCK that let
+// these read what getpid() and uptime() would return,
+// and more, without a system call.
+
+int
+ugetpid(void)
+{
+  return ((volatile struct usyscall *)USYSCALL)->pid;
+}
+
+// The CPU the process was running on at the time;
+// it may already have moved.
+int
+ugetcpu(void)
+{
+  return ((volatile struct usyscall *)USYSCALL)->cpu;
+}
+
+int
+uuptime(void)
+{
+  return ((volatile struct uclock *)UCLOCK)->ticks;
+}
+
+// Nanoseconds since the machine started, from the time CSR.
+uint64
+uclockns(void)
+{
+  uint64 freq = ((struct uclock *)UCLOCK)->freq;
+  uint64 t = r_time();
+
+  return t / freq * 1000000000 + t % freq * 1000000000 / freq;
+}
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct ring;
 
 // system calls
 int fork(void);
@@ -23,6 +24,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int setpriority(int, int);
+int vmsplice(int, const void*, int);
+int ringsetup(struct ring*);
+int ringenter(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +46,11 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int ugetpid(void);
+int ugetcpu(void);
+int uuptime(void);
+uint64 uclockns(void);
+
+// statistics.c
+int statistics(void*, int);
+int statvalue(char*, char*);
@@ -569,6 +569,71 @@ writetest(char *s)
   }
 }
 
+// fsync() from several processes while others keep
+// the file system busy; each must return, and the data
+// must be there afterwards.
+void
+fsynctest(char *s)
+{
+  enum { NCHILD=4, N=20 };
+  char name[] = "fsyncX";
+  int fd, pid, xstatus;
+
+  if(fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+
+  for(int c = 0; c < NCHILD; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[5] = '0' + c;
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      for(int i = 0; i < N; i++){
+        memset(buf, 'a' + c, 100);
+        if(write(fd, buf, 100) != 100){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        if((c % 2) == 0 && fsync(fd) != 0){
+          printf("%s: fsync %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(int c = 0; c < NCHILD; c++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+
+  for(int c = 0; c < NCHILD; c++){
+    name[5] = '0' + c;
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    if(read(fd, buf, N*100) != N*100 || buf[0] != 'a' + c || buf[N*100-1] != 'a' + c){
+      printf("%s: %s has wrong contents\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+  }
+}
+
 void
 writebig(char *s)
 {
@@ -724,6 +789,133 @@ exectest(char *s)
 
 }
 
+// a program can't be written or truncated while a process
+// runs it, since the process may still page the old contents
+// in. this process runs usertests.
+void
+textbusy(char *s)
+{
+  int fd;
+
+  if((fd = open("usertests", O_WRONLY)) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("usertests", O_RDONLY|O_TRUNC)) >= 0){
+    printf("%s: truncated running program\n", s);
+    exit(1);
+  }
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// run prog with stdin from file in (if not 0) and
+// stdout to file out, and return its exit status.
+int
+runprog(char *s, char *prog, char *in, char *out)
+{
+  char *argv[] = { prog, 0 };
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(in){
+      close(0);
+      if(open(in, O_RDONLY) != 0){
+        printf("%s: open %s failed\n", s, in);
+        exit(1);
+      }
+    }
+    close(1);
+    if(open(out, O_CREATE|O_WRONLY|O_TRUNC) != 1){
+      printf("%s: open %s failed\n", s, out);
+      exit(1);
+    }
+    exec(prog, argv);
+    printf("%s: exec %s failed\n", s, prog);
+    exit(1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+// copy file src to dst.
+int
+copyfile(char *src, char *dst)
+{
+  char buf[512];
+  int fd0, fd1, n;
+
+  if((fd0 = open(src, O_RDONLY)) < 0)
+    return -1;
+  if((fd1 = open(dst, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    close(fd0);
+    return -1;
+  }
+  while((n = read(fd0, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      n = -1;
+      break;
+    }
+  }
+  close(fd0);
+  close(fd1);
+  return n;
+}
+
+// exec a program, overwrite its file with a different
+// program, and exec it again. the kernel shares pages of
+// programs between processes; the second exec must not
+// see pages of the first program.
+void
+execrewrite(char *s)
+{
+  char buf[8];
+  int fd, n;
+
+  if(copyfile("echo", "exectmp") < 0){
+    printf("%s: copy echo failed\n", s);
+    exit(1);
+  }
+  if(runprog(s, "exectmp", 0, "exectmp.out") != 0){
+    printf("%s: echo failed\n", s);
+    exit(1);
+  }
+
+  if(copyfile("cat", "exectmp") < 0){
+    printf("%s: copy cat failed\n", s);
+    exit(1);
+  }
+  fd = open("exectmp.in", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, "cat", 3) != 3){
+    printf("%s: create exectmp.in failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(runprog(s, "exectmp", "exectmp.in", "exectmp.out") != 0){
+    printf("%s: cat failed\n", s);
+    exit(1);
+  }
+
+  fd = open("exectmp.out", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("exectmp");
+  unlink("exectmp.in");
+  unlink("exectmp.out");
+  if(n != 3 || memcmp(buf, "cat", 3) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2607,6 +2799,54 @@ sbrklast(char *s)
     exit(1);
 }
 
+// grow the heap as far as sbrk allows, then fork and shrink
+// it again. the heap must stop short of the pages the kernel
+// maps at UCLOCK and USYSCALL, or fork would copy them and
+// the shrink free them.
+void
+sbrkmax(char *s)
+{
+  char *start, *top;
+  int pid, xstatus;
+
+  start = sbrk(0);
+  while(sbrk(1 << 30) != (char*)-1)
+    ;
+  while(sbrk(4096) != (char*)-1)
+    ;
+  top = sbrk(0);
+  if((uint64)top > MAXUVA){
+    printf("%s: heap grew to %p\n", s, top);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(ugetpid() != getpid())
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw the wrong pid\n", s);
+    exit(1);
+  }
+
+  while(top - start > (1 << 30)){
+    sbrk(-(1 << 30));
+    top -= 1 << 30;
+  }
+  sbrk(-(top - start));
+  if(sbrk(0) != start || ugetpid() != getpid()){
+    printf("%s: shrink failed\n", s);
+    exit(1);
+  }
+}
+
 // does sbrk handle signed int32 wrap-around with
 // negative arguments?
 void
@@ -2850,6 +3090,8 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {textbusy, "textbusy"},
+    {execrewrite, "execrewrite"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2859,11 +3101,13 @@ main(int argc, char *argv[])
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
+    {sbrkmax, "sbrkmax"},
     {sbrk8000, "sbrk8000"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
     {opentest, "opentest"},
     {writetest, "writetest"},
+    {fsynctest, "fsynctest"},
     {writebig, "writebig"},
     {createtest, "createtest"},
     {openiputtest, "openiput"},
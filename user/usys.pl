@@ -36,3 +36,8 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("fsync");
+entry("setpriority");
+entry("vmsplice");
+entry("ringsetup");
+entry("ringenter");
@@ -0,0 +1,92 @@
+//
+// Check that the pages the kernel maps at USYSCALL and
+// UCLOCK agree with getpid() and uptime(), in the parent
+// and in a child, and compare what a call costs each way.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+#define NCALL 10000
+
+void
+check(char *who)
+{
+  int t;
+
+  if(ugetpid() != getpid()){
+    printf("vdsotest: %s: ugetpid %d, getpid %d\n", who, ugetpid(), getpid());
+    exit(1);
+  }
+  t = uptime();
+  if(uuptime() < t || uuptime() > t + 1){
+    printf("vdsotest: %s: uuptime %d, uptime %d\n", who, uuptime(), t);
+    exit(1);
+  }
+  if(ugetcpu() < 0 || ugetcpu() >= NCPU){
+    printf("vdsotest: %s: ugetcpu %d\n", who, ugetcpu());
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0, t1, ns;
+  int pid, xstatus, t;
+
+  check("parent");
+  pid = fork();
+  if(pid < 0){
+    printf("vdsotest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    check("child");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // the page is read-only.
+  pid = fork();
+  if(pid == 0){
+    ((struct usyscall *)USYSCALL)->pid = 0;
+    printf("vdsotest: wrote the USYSCALL page\n");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("vdsotest: store to USYSCALL not killed\n");
+    exit(1);
+  }
+
+  // the clock goes forward, at about 100ms a tick.
+  ns = uclockns();
+  t = uuptime();
+  sleep(2);
+  ns = uclockns() - ns;
+  t = uuptime() - t;
+  if(t < 2 || ns < 100000000ULL || ns > (uint64)(t + 1) * 200000000ULL){
+    printf("vdsotest: %d ticks took %d ms\n", t, (int)(ns / 1000000));
+    exit(1);
+  }
+
+  t0 = r_time();
+  for(int i = 0; i < NCALL; i++)
+    getpid();
+  t0 = r_time() - t0;
+  t1 = r_time();
+  for(int i = 0; i < NCALL; i++)
+    ugetpid();
+  t1 = r_time() - t1;
+  // the time CSR counts at 10 MHz in qemu.
+  printf("%d calls: getpid %d us, ugetpid %d us\n",
+         NCALL, (int)(t0 / 10), (int)(t1 / 10));
+  printf("vdsotest: OK\n");
+  exit(0);
+}